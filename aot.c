@@ -0,0 +1,803 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "linkedlist.h"
+#include "talloc.h"
+#include "value.h"
+#include "interpreter.h"
+#include "aot.h"
+
+#define AOT_STACK_SIZE ((size_t)512 << 20)   // reserved, touched only as used
+#define C_STACK_SIZE ((size_t)1 << 30)
+
+// What aotCompile() has written so far. Functions are generated into their
+// own text and appended to functions when finished, so a lambda met in the
+// middle of another function is simply written out first. Heap constants
+// and lambda descriptors are built by setup, in the order they are needed,
+// and referred to by their index in the constants table; globals are read
+// through the binding cell cached at their index in cells.
+typedef struct {
+    FILE *functions;
+    FILE *setup;
+    FILE *run;
+    void **constants;       // heap values and LAMBDA_NODEs, by index
+    int constantCount;
+    int constantCapacity;
+    Value **globals;        // names of the globals, by cell index
+    int globalCount;
+    int globalCapacity;
+    int labels;
+} Program;
+
+// The function being generated. depth is the number of temporaries in use
+// at the current point and maxDepth the most at any point; scope is the
+// activation slot holding the frame the code runs in. lambda is NULL in a
+// top-level form.
+typedef struct {
+    Program *program;
+    FILE *out;
+    int indent;
+    int depth;
+    int maxDepth;
+    int scope;
+    int restarts;
+    Node *lambda;
+} Function;
+
+Value **aotStackTop = NULL;
+Value **aotStackLimit = NULL;
+Value **aotTailCall = NULL;
+int aotTailCount = 0;
+Value *(*aotPrimitives[FAST_EQUAL + 1])(int argc, Value **argv);
+
+// Names of the fastPath values, for the generated code.
+static char *fastPathNames[] = {
+    "NO_FAST_PATH", "FAST_PLUS", "FAST_MINUS", "FAST_TIMES", "FAST_LESS", "FAST_GREATER",
+    "FAST_EQUAL"
+};
+
+static Value **aotStack = NULL;
+static Value **constantsBase = NULL;
+static Value **constantsEnd = NULL;
+static Frame *globalFrame = NULL;
+static void (*programSetup)() = NULL;
+static void (*programRun)() = NULL;
+
+//Helper Functions
+//generate the C function called name that runs body, of lambda or of a top-level form
+static void compileFunction(Program *program, char *name, Node *body, Node *lambda);
+//write the code that leaves the value of node in v
+static void compileNode(Function *function, Node *node, int tail);
+//compile children first onwards of node, keeping the value of the last
+static void compileSequence(Function *function, Node *node, int first, int tail);
+//compile a variable reference, set! or define
+static void compileVariable(Function *function, Node *node);
+//compile a short-circuiting and or or
+static void compileLogic(Function *function, Node *node, int tail);
+//compile a cond
+static void compileCond(Function *function, Node *node, int tail);
+//compile a let, let* or letrec
+static void compileLet(Function *function, Node *node, int tail);
+//compile a call, with the fixnum fast path and tail calls
+static void compileCall(Function *function, Node *node, int tail);
+//index of the LAMBDA_NODE's descriptor, generating its function the first time
+static int lambdaConstant(Program *program, Node *lambda);
+//index of a heap value in the constants table, building it the first time
+static int addConstant(Program *program, Value *value);
+//index of the binding cell of a global
+static int globalCell(Program *program, Value *name);
+//append an entry to a growable table
+static int addEntry(void ***entries, int *count, int *capacity, void *entry);
+//write the C expression for a value; heap values must be constants already
+static void writeValue(Program *program, FILE *out, Value *value);
+//write a C string literal
+static void writeString(FILE *out, char *text);
+//write the expression for the frame depth levels out from the current one
+static void writeScope(Function *function, int depth);
+//start a line at the current indentation and write the formatted text
+static void startLine(Function *function, char *format, ...);
+//write a whole line at the current indentation
+static void line(Function *function, char *format, ...);
+//store v into the next temporary and return its activation slot
+static int pushTemp(Function *function);
+//run the program on the thread with the large stack
+static void *runProgram(void *unused);
+//call base[0] on the argc operands after it, and every tail call it makes
+static Value *callLoop(Value **base, int argc);
+
+void aotCompile(Value *tree, int optimize){
+    initGlobalFrame();
+    Node **forms = (Node **)tallocArray(length(tree));
+    gcPushRoot(&tree);
+    gcPushRoot(&forms);
+    analyzeProgram(tree, forms, optimize);
+
+    // nothing below allocates across a safepoint, so no value moves
+    Program program = {NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, 0};
+    char *functionsText, *setupText, *runText;
+    size_t functionsLength, setupLength, runLength;
+    program.functions = open_memstream(&functionsText, &functionsLength);
+    program.setup = open_memstream(&setupText, &setupLength);
+    program.run = open_memstream(&runText, &runLength);
+    if (program.functions == NULL || program.setup == NULL || program.run == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+
+    int form = 0;
+    for (Value *curr = tree; typeOf(curr) == CONS_TYPE; curr = cdr(curr), form++) {
+        char name[32];
+        snprintf(name, sizeof(name), "form%d", form);
+        compileFunction(&program, name, forms[form], NULL);
+        fprintf(program.run, "    printEvalResult(aotRunForm(%s));\n", name);
+    }
+    fclose(program.functions);
+    fclose(program.setup);
+    fclose(program.run);
+
+    // an empty table still needs one entry to be declared
+    printf("// Generated from a Scheme program by interpreter --compile.\n");
+    printf("#include \"aot.h\"\n\n");
+    printf("static Value *constants[%d];\n", program.constantCount + 1);
+    printf("static Value *cells[%d];\n\n", program.globalCount + 1);
+    printf("%s", functionsText);
+    printf("static void setup() {\n");
+    printf("    aotAddConstants(constants, %d);\n", program.constantCount);
+    printf("%s}\n\n", setupText);
+    printf("static void program() {\n%s}\n\n", runText);
+    printf("int main() {\n    return aotMain(setup, program);\n}\n");
+
+    free(functionsText);
+    free(setupText);
+    free(runText);
+    free(program.constants);
+    free(program.globals);
+    gcPopRoots(2);
+}
+
+// The activation is a and the value of the expression being run is kept in
+// v, like a register. A self tail call jumps back to start.
+static void compileFunction(Program *program, char *name, Node *body, Node *lambda) {
+    char *text;
+    size_t length;
+    Function function = {program, open_memstream(&text, &length), 1, 0, 0, AOT_FRAME, 0, lambda};
+    if (function.out == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    compileNode(&function, body, 1);
+    fclose(function.out);
+
+    fprintf(program->functions, "static Value *%s(Value **a) {\n", name);
+    fprintf(program->functions, "    Value *v;\n");
+    fprintf(program->functions, "    aotEnter(a, %d);\n", function.maxDepth);
+    if (function.restarts) {
+        fprintf(program->functions, "start:\n");
+    }
+    fprintf(program->functions, "%s    return v;\n}\n\n", text);
+    free(text);
+}
+
+static void compileNode(Function *function, Node *node, int tail) {
+    switch (node->kind) {
+        case CONSTANT_NODE:
+            if (node->value != NULL && !isImmediate(node->value)) {
+                addConstant(function->program, node->value);
+            }
+            startLine(function, "v = ");
+            writeValue(function->program, function->out, node->value);
+            fprintf(function->out, ";\n");
+            break;
+
+        case VARIABLE_NODE:
+        case SET_NODE:
+        case DEFINE_NODE:
+            compileVariable(function, node);
+            break;
+
+        case IF_NODE:
+            compileNode(function, node->children[0], 0);
+            line(function, "if (v != TRUE_VALUE && v != FALSE_VALUE) {");
+            line(function, "    aotFail(\"Evaluation error: condition of an if expression must be a boolean\");");
+            line(function, "}");
+            line(function, "if (v == TRUE_VALUE) {");
+            function->indent++;
+            compileNode(function, node->children[1], tail);
+            function->indent--;
+            line(function, "} else {");
+            function->indent++;
+            compileNode(function, node->children[2], tail);
+            function->indent--;
+            line(function, "}");
+            break;
+
+        case LET_NODE:
+        case LETSTAR_NODE:
+        case LETREC_NODE:
+            compileLet(function, node, tail);
+            break;
+
+        case BEGIN_NODE:
+            if (node->count == 0) {
+                line(function, "v = VOID_VALUE;");
+            } else {
+                compileSequence(function, node, 0, tail);
+            }
+            break;
+
+        case AND_NODE:
+        case OR_NODE:
+            compileLogic(function, node, tail);
+            break;
+
+        case COND_NODE:
+            compileCond(function, node, tail);
+            break;
+
+        case LAMBDA_NODE: {
+            int lambda = lambdaConstant(function->program, node);
+            line(function, "v = makeClosure((Node *)constants[%d], (Frame *)a[%d]);", lambda, function->scope);
+            break;
+        }
+
+        case CALL_NODE:
+            compileCall(function, node, tail);
+            break;
+
+        case ERROR_NODE:
+            startLine(function, "aotFail(");
+            writeString(function->out, node->value->s);
+            fprintf(function->out, ");\n");
+            break;
+    }
+}
+
+static void compileSequence(Function *function, Node *node, int first, int tail) {
+    for (int i = first; i < node->count; i++) {
+        compileNode(function, node->children[i], tail && i == node->count - 1);
+    }
+}
+
+// A global is read through the binding cell cached in its cell, as the
+// evaluators cache it in the node. A define inside a body is a local one.
+static void compileVariable(Function *function, Node *node) {
+    Program *program = function->program;
+    if (node->kind == VARIABLE_NODE && node->depth < 0) {
+        line(function, "v = aotGlobal(&cells[%d], constants[%d]);",
+             globalCell(program, node->value), addConstant(program, node->value));
+        return;
+    }
+    if (node->kind == VARIABLE_NODE) {
+        startLine(function, "v = aotLocal(");
+        writeScope(function, node->depth);
+        fprintf(function->out, "->slots[%d], %d);\n", node->index, node->boxed);
+        return;
+    }
+
+    compileNode(function, node->children[0], 0);
+    if (node->kind == DEFINE_NODE && node->depth < 0) {
+        line(function, "aotDefine(constants[%d], v);", addConstant(program, node->value));
+    } else if (node->depth < 0) {
+        line(function, "aotSetGlobal(&cells[%d], constants[%d], v);",
+             globalCell(program, node->value), addConstant(program, node->value));
+    } else {
+        startLine(function, "setLocal(");
+        writeScope(function, node->kind == DEFINE_NODE ? 0 : node->depth);
+        fprintf(function->out, ", %d, v);\n", node->index);
+    }
+    line(function, "v = VOID_VALUE;");
+}
+
+// Every operand but the last jumps to the end with its value when it
+// decides the result.
+static void compileLogic(Function *function, Node *node, int tail) {
+    if (node->count == 0) {
+        line(function, "v = %s;", node->kind == AND_NODE ? "TRUE_VALUE" : "FALSE_VALUE");
+        return;
+    }
+    int end = function->program->labels++;
+    for (int i = 0; i < node->count - 1; i++) {
+        compileNode(function, node->children[i], 0);
+        line(function, "if (v %s FALSE_VALUE) {", node->kind == AND_NODE ? "==" : "!=");
+        line(function, "    goto end%d;", end);
+        line(function, "}");
+    }
+    compileNode(function, node->children[node->count - 1], tail);
+    fprintf(function->out, "end%d:;\n", end);
+}
+
+// Clauses are tried in order up to an else clause; with none taken the value
+// is void.
+static void compileCond(Function *function, Node *node, int tail) {
+    int end = function->program->labels++;
+    int step = 0;
+    for (; step < node->count; step += 2) {
+        if (node->children[step] == NULL) {
+            compileNode(function, node->children[step + 1], tail);
+            break;
+        }
+        compileNode(function, node->children[step], 0);
+        int next = function->program->labels++;
+        line(function, "if (v != TRUE_VALUE && v != FALSE_VALUE) {");
+        line(function, "    aotFail(\"Evaluation error [cond]: incorrect type in condition\");");
+        line(function, "}");
+        line(function, "if (v == FALSE_VALUE) {");
+        line(function, "    goto next%d;", next);
+        line(function, "}");
+        // a clause the analyzer rejected has an error for a test and no body
+        if (node->children[step + 1] != NULL) {
+            compileNode(function, node->children[step + 1], tail);
+        }
+        line(function, "goto end%d;", end);
+        fprintf(function->out, "next%d:;\n", next);
+    }
+    if (step >= node->count) {
+        line(function, "v = VOID_VALUE;");
+    }
+    fprintf(function->out, "end%d:;\n", end);
+}
+
+// A let's initializers run in the enclosing frame and are collected in
+// temporaries; let* and letrec make the frame first and bind each name in
+// it as the evaluators do. The new frame takes the first temporary, and it
+// is released with the whole call.
+static void compileLet(Function *function, Node *node, int tail) {
+    int first = function->depth;
+    if (node->kind == LET_NODE) {
+        for (int i = 0; i < node->index; i++) {
+            compileNode(function, node->children[i], 0);
+            pushTemp(function);
+        }
+    }
+    line(function, "{");
+    line(function, "    Frame *frame = aotFrame(%d, a, %d);", node->frameSize, function->scope);
+    for (int i = 0; node->kind == LET_NODE && i < node->index; i++) {
+        line(function, "    frame->slots[%d] = a[%d];", i, AOT_SLOTS + first + i);
+    }
+    line(function, "    a[%d] = (Value *)frame;", AOT_SLOTS + first);
+    line(function, "}");
+    int frame = AOT_SLOTS + first;
+    function->depth = first + 1;
+    if (function->depth > function->maxDepth) {
+        function->maxDepth = function->depth;
+    }
+    int enclosing = function->scope;
+    function->scope = frame;
+
+    if (node->kind == LETREC_NODE) {
+        for (int i = 0; i < node->index; i++) {
+            compileNode(function, node->children[i], 0);
+            pushTemp(function);
+        }
+        // a closure made by an initializer may have boxed a slot already
+        for (int i = 0; i < node->index; i++) {
+            line(function, "setLocal((Frame *)a[%d], %d, a[%d]);", frame, i, frame + 1 + i);
+        }
+        function->depth = first + 1;
+    }
+
+    compileSequence(function, node, node->kind == LETSTAR_NODE ? 0 : node->index, tail);
+    function->scope = enclosing;
+    function->depth = first;
+}
+
+// The operator and operands are evaluated into temporaries. A call site with
+// a fast path adds, subtracts, multiplies or compares two fixnums right here
+// when the operator is still the primitive. A tail call of the closure being
+// run reuses its frame and starts the body again; any other tail call is
+// handed back to the call loop with its operands.
+static void compileCall(Function *function, Node *node, int tail) {
+    int first = AOT_SLOTS + function->depth;
+    int argc = node->count - 1;
+    for (int i = 0; i < node->count; i++) {
+        compileNode(function, node->children[i], 0);
+        pushTemp(function);
+    }
+
+    int slow = node->index != NO_FAST_PATH && argc == 2;
+    if (slow) {
+        line(function, "v = aotFastPath(%s, &a[%d]);", fastPathNames[node->index], first);
+        line(function, "if (v == NULL) {");
+        function->indent++;
+    }
+    Node *lambda = function->lambda;
+    if (tail && lambda != NULL && typeOf(lambda->value) != SYMBOL_TYPE && argc == lambda->index) {
+        function->restarts = 1;
+        line(function, "if (a[%d] == a[%d]) {", first, AOT_CLOSURE);
+        line(function, "    aotRestart(a, %d, &a[%d]);", argc, first + 1);
+        line(function, "    goto start;");
+        line(function, "}");
+    }
+    if (tail) {
+        line(function, "aotTailCall = &a[%d];", first);
+        line(function, "aotTailCount = %d;", argc);
+        line(function, "return AOT_TAIL_CALL;");
+    } else {
+        line(function, "v = aotApply(%d, &a[%d]);", argc, first);
+    }
+    if (slow) {
+        function->indent--;
+        line(function, "}");
+    }
+    function->depth = first - AOT_SLOTS;
+}
+
+// The descriptor carries what makeClosure() and a call need: the parameters,
+// the frame size and the variables captured.
+static int lambdaConstant(Program *program, Node *lambda) {
+    for (int i = 0; i < program->constantCount; i++) {
+        if (program->constants[i] == lambda) {
+            return i;
+        }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "lambda%d", program->labels++);
+    compileFunction(program, name, lambda->children[0], lambda);
+
+    if (!isImmediate(lambda->value)) {
+        addConstant(program, lambda->value);
+    }
+    int index = addEntry(&program->constants, &program->constantCount, &program->constantCapacity, lambda);
+    fprintf(program->setup, "    constants[%d] = (Value *)aotLambda(%s, ", index, name);
+    writeValue(program, program->setup, lambda->value);
+    fprintf(program->setup, ", %d, %d, %d);\n", lambda->index, lambda->frameSize, lambda->count - 1);
+    for (int i = 1; i < lambda->count; i++) {
+        Node *variable = lambda->children[i];
+        fprintf(program->setup, "    aotCapture((Node *)constants[%d], %d, %d, %d, %d);\n",
+                index, i - 1, variable->depth, variable->index, variable->boxed);
+    }
+    return index;
+}
+
+// Equal data are only shared when they are the same object, as they are in
+// the analyzed program.
+static int addConstant(Program *program, Value *value) {
+    for (int i = 0; i < program->constantCount; i++) {
+        if (program->constants[i] == value) {
+            return i;
+        }
+    }
+    if (value->type == CONS_TYPE) {
+        if (!isImmediate(car(value))) {
+            addConstant(program, car(value));
+        }
+        if (!isImmediate(cdr(value))) {
+            addConstant(program, cdr(value));
+        }
+    }
+
+    int index = addEntry(&program->constants, &program->constantCount, &program->constantCapacity, value);
+    fprintf(program->setup, "    constants[%d] = ", index);
+    switch (value->type) {
+        case DOUBLE_TYPE:
+            fprintf(program->setup, "makeDouble(");
+            if (isnan(value->d)) {
+                fprintf(program->setup, "__builtin_nan(\"\")");
+            } else if (isinf(value->d)) {
+                fprintf(program->setup, value->d > 0 ? "__builtin_inf()" : "-__builtin_inf()");
+            } else {
+                fprintf(program->setup, "%a", value->d);
+            }
+            fprintf(program->setup, ");\n");
+            break;
+
+        case SYMBOL_TYPE:
+            fprintf(program->setup, "intern(");
+            writeString(program->setup, value->s);
+            fprintf(program->setup, ");\n");
+            break;
+
+        case STR_TYPE:
+        case DOT_TYPE:
+            fprintf(program->setup, "aotText(%s, ", value->type == STR_TYPE ? "STR_TYPE" : "DOT_TYPE");
+            writeString(program->setup, value->s);
+            fprintf(program->setup, ");\n");
+            break;
+
+        case CONS_TYPE:
+            fprintf(program->setup, "cons(");
+            writeValue(program, program->setup, car(value));
+            fprintf(program->setup, ", ");
+            writeValue(program, program->setup, cdr(value));
+            fprintf(program->setup, ");\n");
+            break;
+
+        default:
+            fprintf(stderr, "Error: cannot compile a constant of type %d\n", value->type);
+            texit(1);
+    }
+    return index;
+}
+
+static int globalCell(Program *program, Value *name) {
+    for (int i = 0; i < program->globalCount; i++) {
+        if (program->globals[i] == name) {
+            return i;
+        }
+    }
+    return addEntry((void ***)&program->globals, &program->globalCount, &program->globalCapacity, name);
+}
+
+static int addEntry(void ***entries, int *count, int *capacity, void *entry) {
+    if (*count == *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        *entries = realloc(*entries, sizeof(void *) * *capacity);
+        if (*entries == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+    }
+    (*entries)[*count] = entry;
+    return (*count)++;
+}
+
+static void writeValue(Program *program, FILE *out, Value *value) {
+    if (value == NULL) {
+        fprintf(out, "NULL");
+    } else if (isFixnum(value)) {
+        fprintf(out, "makeFixnum(%ldL)", fixnumValue(value));
+    } else if (isImmediate(value)) {
+        fprintf(out, "%s", value == NULL_VALUE ? "NULL_VALUE" : value == TRUE_VALUE ? "TRUE_VALUE"
+                : value == FALSE_VALUE ? "FALSE_VALUE" : "VOID_VALUE");
+    } else {
+        fprintf(out, "constants[%d]", addConstant(program, value));
+    }
+}
+
+// Every byte that is not plainly printable is written as a three-digit
+// octal escape, which cannot run into the characters after it.
+static void writeString(FILE *out, char *text) {
+    fputc('"', out);
+    for (unsigned char *c = (unsigned char *)text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < ' ' || *c > '~' || *c == '?') {
+            fprintf(out, "\\%03o", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void writeScope(Function *function, int depth) {
+    fprintf(function->out, "((Frame *)a[%d])", function->scope);
+    for (int i = 0; i < depth; i++) {
+        fprintf(function->out, "->parent");
+    }
+}
+
+static void startLine(Function *function, char *format, ...) {
+    for (int i = 0; i < function->indent; i++) {
+        fprintf(function->out, "    ");
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(function->out, format, arguments);
+    va_end(arguments);
+}
+
+static void line(Function *function, char *format, ...) {
+    for (int i = 0; i < function->indent; i++) {
+        fprintf(function->out, "    ");
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(function->out, format, arguments);
+    va_end(arguments);
+    fprintf(function->out, "\n");
+}
+
+static int pushTemp(Function *function) {
+    int slot = AOT_SLOTS + function->depth;
+    line(function, "a[%d] = v;", slot);
+    function->depth++;
+    if (function->depth > function->maxDepth) {
+        function->maxDepth = function->depth;
+    }
+    return slot;
+}
+
+// The program runs on a thread of its own, whose stack has room for calls
+// nested as deeply as the evaluators allow.
+int aotMain(void (*setup)(), void (*program)()){
+    programSetup = setup;
+    programRun = program;
+    pthread_attr_t attributes;
+    pthread_t thread;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, C_STACK_SIZE);
+    if (pthread_create(&thread, &attributes, runProgram, NULL) == 0) {
+        pthread_join(thread, NULL);
+    } else {
+        runProgram(NULL);
+    }
+    pthread_attr_destroy(&attributes);
+    return 0;
+}
+
+static void *runProgram(void *unused) {
+    (void)unused;
+    aotStack = mmap(NULL, AOT_STACK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (aotStack == MAP_FAILED) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    aotStackTop = aotStack;
+    aotStackLimit = aotStack + AOT_STACK_SIZE / sizeof(Value *);
+    gcAddRootStack(&aotStack, &aotStackTop);
+    globalFrame = initGlobalFrame();
+    gcAddGlobalRoot(&globalFrame);
+    for (fastPath path = FAST_PLUS; path <= FAST_EQUAL; path++) {
+        aotPrimitives[path] = fastPathPrimitive(path);
+    }
+
+    programSetup();
+    programRun();
+    tfree();
+    munmap(aotStack, AOT_STACK_SIZE);
+    return NULL;
+}
+
+void aotAddConstants(Value **base, int count){
+    constantsBase = base;
+    constantsEnd = base + count;
+    gcAddRootStack(&constantsBase, &constantsEnd);
+}
+
+// Nodes are old objects, and params may still be in the nursery.
+Node *aotLambda(Value *(*code)(Value **activation), Value *params, int argc,
+                int frameSize, int captures){
+    Node *lambda = makeNode(LAMBDA_NODE, params, 1 + captures);
+    lambda->index = argc;
+    lambda->frameSize = frameSize;
+    lambda->compiled = code;
+    gcWriteBarrier(lambda);
+    return lambda;
+}
+
+void aotCapture(Node *lambda, int capture, int depth, int index, int boxed){
+    Node *variable = makeNode(VARIABLE_NODE, NULL, 0);
+    variable->depth = depth;
+    variable->index = index;
+    variable->boxed = boxed;
+    lambda->children[1 + capture] = variable;
+}
+
+Value *aotText(valueType type, char *text){
+    Value *value = tallocValue();
+    value->type = type;
+    value->s = talloc(strlen(text) + 1);
+    strcpy(value->s, text);
+    return value;
+}
+
+// A form runs in an activation at the bottom of the free shadow stack; a
+// tail call it ends with continues in the call loop from the same place.
+Value *aotRunForm(Value *(*form)(Value **activation)){
+    void *mark = frameStackMark();
+    Value **activation = aotStackTop;
+    if (activation + AOT_SLOTS > aotStackLimit) {
+        aotOverflow();
+    }
+    activation[AOT_FRAME] = (Value *)globalFrame;
+    activation[AOT_CLOSURE] = NULL;
+    Value *result = form(activation);
+    if (result == AOT_TAIL_CALL) {
+        int argc = aotTailCount;
+        memmove(activation, aotTailCall, sizeof(Value *) * (argc + 1));
+        result = callLoop(activation, argc);
+    }
+    aotStackTop = activation;
+    frameStackRelease(mark);
+    return result;
+}
+
+Value *aotApply(int argc, Value **operands){
+    Value **base = aotStackTop;
+    if (base + argc + 1 + AOT_SLOTS > aotStackLimit) {
+        aotOverflow();
+    }
+    memcpy(base, operands, sizeof(Value *) * (argc + 1));
+    return callLoop(base, argc);
+}
+
+// The operands of each call sit at base, with the activation of a closure
+// right above them. A tail call the callee returns leaves its operands above
+// base; they are moved down, and the frames the callee made are released
+// before the next call, so tail calls run in constant space. Each call is a
+// safepoint.
+static Value *callLoop(Value **base, int argc) {
+    void *mark = frameStackMark();
+    while (1) {
+        aotStackTop = base + 1 + argc;
+        if (gcRequested) {
+            gcCollectRequested();
+        }
+        frameStackRelease(mark);
+
+        Value *procedure = base[0];
+        Value *result;
+        if (typeOf(procedure) == CLOSURE_TYPE) {
+            Node *lambda = procedure->closure.code;
+            Value **activation = base + 1 + argc;
+            if (activation + AOT_SLOTS > aotStackLimit) {
+                aotOverflow();
+            }
+            Frame *frame = tallocStackFrame(lambda->frameSize);
+            frame->parent = procedure->closure.frame;
+            if (typeOf(lambda->value) == SYMBOL_TYPE) {
+                Value *args = makeNull();
+                for (int i = argc - 1; i >= 0; i--) {
+                    args = cons(base[1 + i], args);
+                }
+                frame->slots[0] = args;
+            } else if (lambda->index != argc) {
+                printf("Evaluation error: incurrent number of arguments of procedure\n");
+                texit(0);
+            } else {
+                memcpy(frame->slots, base + 1, sizeof(Value *) * argc);
+            }
+            activation[AOT_FRAME] = (Value *)frame;
+            activation[AOT_CLOSURE] = procedure;
+            result = lambda->compiled(activation);
+        } else if (typeOf(procedure) == PRIMITIVE_TYPE) {
+            result = (procedure->primFn)(argc, base + 1);
+        } else {
+            printf("Evaluation error: undefined procedure\n");
+            texit(0);
+            return NULL;
+        }
+
+        if (result != AOT_TAIL_CALL) {
+            aotStackTop = base;
+            frameStackRelease(mark);
+            return result;
+        }
+        argc = aotTailCount;
+        memmove(base, aotTailCall, sizeof(Value *) * (argc + 1));
+    }
+}
+
+void aotDefine(Value *name, Value *value){
+    addBinding(name, value, globalFrame);
+}
+
+void aotSetGlobal(Value **cell, Value *name, Value *value){
+    if (*cell == NULL) {
+        *cell = findTableBinding(name, globalFrame);
+    }
+    if (*cell != NULL) {
+        (*cell)->c.cdr = value;
+        gcWriteBarrier(*cell);
+    }
+}
+
+Value *aotFindGlobal(Value **cell, Value *name){
+    *cell = findTableBinding(name, globalFrame);
+    if (*cell == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    return *cell;
+}
+
+void aotFail(char *message){
+    printf("%s\n", message);
+    texit(0);
+}
+
+void aotUnbound(){
+    aotFail("Evaluation error: variable that is not bound in the current frame or any of its ancestors");
+}
+
+void aotOverflow(){
+    printf("Error: out of memory\n");
+    texit(1);
+}
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include "value.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "linkedlist.h"
+#include "symbol.h"
+
+#ifndef _AOT
+#define _AOT
+
+// A program can be compiled ahead of time into C instead of being run.
+// aotCompile() analyzes it exactly as interpret() does and writes a
+// translation unit with one C function per lambda and per top-level form.
+// Linked against the runtime (every source file but main.c) it prints what
+// interpret() would print, without tokenizing, parsing or interpreting
+// anything at run time; `make compiled PROGRAM=program.scm` builds one.
+//
+// Generated functions run on a shadow stack of activations registered with
+// the collector, the way native code of the JIT (jit.h) does: the frame the
+// function runs in, the closure called and then the temporaries it needs.
+// Everything they hold across a call lives there. Calls in tail position
+// return to the caller's call loop instead of growing the C stack, so tail
+// recursion runs in constant space; other calls nest on a large C stack.
+// The rest of this header is the runtime side, which generated code calls.
+
+// Write the C translation unit for the program in tree to stdout. With
+// optimize nonzero the program goes through optimizeProgram() first.
+void aotCompile(Value *tree, int optimize);
+
+// Slots at the start of every activation, before the temporaries.
+#define AOT_FRAME 0
+#define AOT_CLOSURE 1
+#define AOT_SLOTS 2
+
+// What a generated function returns for a call in tail position, after
+// leaving the operator and operands at aotTailCall. Never a real value.
+#define AOT_TAIL_CALL ((Value *)0x22)
+
+// The shadow stack: everything below aotStackTop is a root.
+extern Value **aotStackTop;
+extern Value **aotStackLimit;
+
+// Operator and operands of the tail call a generated function returned.
+extern Value **aotTailCall;
+extern int aotTailCount;
+
+// Primitive functions the call sites with each fastPath expect.
+extern Value *(*aotPrimitives[])(int argc, Value **argv);
+
+// Run a compiled program: make the global frame, call setup to build its
+// constants, then program, on a C stack deep enough for deep recursion.
+int aotMain(void (*setup)(), void (*program)());
+
+// Register the constants of a compiled program, count entries from base, as
+// roots. base must be static storage.
+void aotAddConstants(Value **base, int count);
+
+// Descriptor of a compiled lambda: a LAMBDA_NODE with no body whose
+// parameters are params, taking argc arguments (ignored with a rest
+// parameter), running code in frames of frameSize slots, and capturing
+// captures variables described by aotCapture().
+Node *aotLambda(Value *(*code)(Value **activation), Value *params, int argc,
+                int frameSize, int captures);
+
+// Make capture number capture of lambda the variable slot index of the frame
+// depth levels out, boxed if boxed is nonzero; see makeClosure().
+void aotCapture(Node *lambda, int capture, int depth, int index, int boxed);
+
+// A STR_TYPE (or other text) value holding a copy of text.
+Value *aotText(valueType type, char *text);
+
+// Run a top-level form in the global frame and return its value.
+Value *aotRunForm(Value *(*form)(Value **activation));
+
+// Call operands[0] on the argc operands after it and return its value.
+Value *aotApply(int argc, Value **operands);
+
+// Define a global variable, or give an existing one a new value.
+void aotDefine(Value *name, Value *value);
+
+// Set a global variable through its cached binding cell; setting one that is
+// bound nowhere does nothing.
+void aotSetGlobal(Value **cell, Value *name, Value *value);
+
+// Binding cell of a global variable, found the first time; reports an
+// unbound variable and exits.
+Value *aotFindGlobal(Value **cell, Value *name);
+
+// Report an evaluation error and exit.
+void aotFail(char *message);
+
+// Report a local variable read before it is bound and exit.
+void aotUnbound();
+
+// Report a shadow stack that is full and exit.
+void aotOverflow();
+
+// Start an activation with temps temporaries, all NULL.
+ALWAYS_INLINE void aotEnter(Value **activation, int temps) {
+    if (activation + AOT_SLOTS + temps > aotStackLimit) {
+        aotOverflow();
+    }
+    for (int i = 0; i < temps; i++) {
+        activation[AOT_SLOTS + i] = NULL;
+    }
+    aotStackTop = activation + AOT_SLOTS + temps;
+}
+
+ALWAYS_INLINE Value *aotGlobal(Value **cell, Value *name) {
+    if (*cell == NULL) {
+        return aotFindGlobal(cell, name)->c.cdr;
+    }
+    return (*cell)->c.cdr;
+}
+
+// Value of a local variable read straight from its slot.
+ALWAYS_INLINE Value *aotLocal(Value *slot, int boxed) {
+    if (boxed && isBox(slot)) {
+        slot = slot->c.car;
+    }
+    if (slot == NULL) {
+        aotUnbound();
+    }
+    return slot;
+}
+
+// A new frame of count slots whose parent is the frame in activation slot
+// scope.
+ALWAYS_INLINE Frame *aotFrame(int count, Value **activation, int scope) {
+    Frame *frame = tallocStackFrame(count);
+    frame->parent = (Frame *)activation[scope];
+    return frame;
+}
+
+// Value of a call at a site with the given fast path, computed right here,
+// or NULL when it must be made as usual; see fixnumFastPath().
+ALWAYS_INLINE Value *aotFastPath(fastPath path, Value **operands) {
+    Value *procedure = operands[0];
+    if (!isFixnum(operands[1]) || !isFixnum(operands[2]) || isImmediate(procedure)
+        || procedure->type != PRIMITIVE_TYPE || procedure->primFn != aotPrimitives[path]) {
+        return NULL;
+    }
+    long x = fixnumValue(operands[1]);
+    long y = fixnumValue(operands[2]);
+    long result;
+    switch (path) {
+        case FAST_PLUS:
+            result = x + y;
+            break;
+
+        case FAST_MINUS:
+            result = x - y;
+            break;
+
+        case FAST_TIMES:
+            if (__builtin_mul_overflow(x, y, &result)) {
+                return NULL;
+            }
+            break;
+
+        case FAST_LESS:
+            return makeBool(x < y);
+
+        case FAST_GREATER:
+            return makeBool(x > y);
+
+        case FAST_EQUAL:
+            return makeBool(x == y);
+
+        default:
+            return NULL;
+    }
+    if (result < FIXNUM_MIN || result > FIXNUM_MAX) {
+        return NULL;
+    }
+    return makeFixnum(result);
+}
+
+// Run the closure in the activation again, as a tail call of itself: its
+// frame gets the new arguments and its other slots are unbound again, and
+// every frame made since is released. A safepoint.
+ALWAYS_INLINE void aotRestart(Value **activation, int argc, Value **arguments) {
+    Frame *frame = (Frame *)activation[AOT_FRAME];
+    for (int i = 0; i < frame->count; i++) {
+        frame->slots[i] = i < argc ? arguments[i] : NULL;
+    }
+    if ((char *)frame >= frameStack && (char *)frame < frameStackTop) {
+        frameStackRelease(&frame->slots[frame->count]);
+    } else {
+        gcWriteBarrier(frame);
+    }
+    if (gcRequested) {
+        gcCollectRequested();
+    }
+}
+
+#endif
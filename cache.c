@@ -0,0 +1,529 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "value.h"
+#include "talloc.h"
+#include "linkedlist.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "symbol.h"
+#include "cache.h"
+
+// What each datum in a cache starts with. A symbol is the index of its name
+// in the table at the start of the cache; a list is its length followed by
+// its elements. Lengths, indices and fixnums are variable-length numbers:
+// seven bits a byte, low bits first, with the top bit set on every byte but
+// the last. A fixnum is zigzag-coded first, so small negative ones are
+// short too.
+#define TAG_END 0
+#define TAG_FIXNUM 1
+#define TAG_DOUBLE 2
+#define TAG_STRING 3
+#define TAG_SYMBOL 4
+#define TAG_TRUE 5
+#define TAG_FALSE 6
+#define TAG_NULL 7
+#define TAG_LIST 8
+#define TAG_DOT 9
+#define TAG_OPENBRACKET 10
+#define TAG_CLOSEBRACKET 11
+
+// Changed whenever the layout of a cache changes, so old ones are replaced.
+#define CACHE_VERSION 2
+
+// The start of every cache, followed by the number of symbols and their
+// names, each a length and that many bytes, then the datums and TAG_END.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;   // of the source
+    uint64_t size;   // of the whole cache
+} CacheHeader;
+
+// Bytes of a cache being recorded.
+typedef struct {
+    unsigned char *bytes;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+//Helper Functions
+//64-bit FNV-1a hash of length bytes, taken a word at a time
+static uint64_t hashSource(unsigned char *text, size_t length);
+//map the cache at cachePath and intern its symbols; 0 if it is not valid
+static int loadCache(uint64_t hash);
+//decode the datum at cursor
+static Value *readDatum();
+//read count bytes at cursor into to
+static void readBytes(void *to, size_t count);
+//read a variable-length number at cursor
+static uint64_t readNumber();
+//report that the cache is damaged and exit
+static void damaged();
+//encode datum into the datums being recorded
+static void writeDatum(Value *datum);
+//append count bytes from to the buffer
+static void writeBytes(Buffer *buffer, void *from, size_t count);
+//append number to the buffer in variable-length form
+static void writeNumber(Buffer *buffer, uint64_t number);
+//index of symbol in the table being recorded, adding it the first time
+static uint32_t symbolIndex(Value *symbol);
+//write the recorded cache next to the source
+static void writeCache();
+
+// Path of the cache, or NULL when the program is not being cached.
+static char *cachePath = NULL;
+static uint64_t sourceHash = 0;
+
+// The cache being read: the datums still to decode start at cursor.
+static unsigned char *cursor = NULL;
+static unsigned char *limit = NULL;
+static Value **symbols = NULL;
+static uint64_t symbolsLoaded = 0;
+
+// The cache being recorded: symbol names and datums go to separate
+// buffers, and each symbol seen is given the next index, which a table
+// keyed by the (never moving) symbol remembers.
+static int recording = 0;
+static Buffer names = {NULL, 0, 0};
+static Buffer datums = {NULL, 0, 0};
+static uint32_t symbolCount = 0;
+static Value **indexKeys = NULL;
+static uint32_t *indexValues = NULL;
+static uint32_t indexCapacity = 0;
+
+// Only a regular file is cached; anything else is just read.
+void cacheOpen(char *path){
+    int source = open(path, O_RDONLY);
+    struct stat status;
+    if (source < 0 || fstat(source, &status) != 0) {
+        printf("Error: cannot open %s\n", path);
+        texit(1);
+    }
+    dup2(source, 0);
+    close(source);
+    if (!S_ISREG(status.st_mode)) {
+        return;
+    }
+
+    // the hash is over the bytes of the source, so checking it lexes nothing
+    sourceHash = hashSource(NULL, 0);
+    if (status.st_size > 0) {
+        unsigned char *text = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+        if (text == MAP_FAILED) {
+            return;
+        }
+        sourceHash = hashSource(text, status.st_size);
+        munmap(text, status.st_size);
+    }
+
+    cachePath = malloc(strlen(path) + 2);
+    if (cachePath == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    sprintf(cachePath, "%sc", path);
+    recording = !loadCache(sourceHash);
+}
+
+Value *cacheNext(){
+    if (cursor != NULL) {
+        if (*cursor == TAG_END) {
+            return NULL;
+        }
+        return readDatum();
+    }
+
+    Value *datum = parseNext();
+    if (recording) {
+        if (datum == NULL) {
+            writeCache();
+        } else {
+            writeDatum(datum);
+        }
+    }
+    return datum;
+}
+
+// Built front to back like the list parse() returns.
+Value *cacheProgram(){
+    Value *program = makeNull();
+    Value *last = NULL;
+    for (Value *datum = cacheNext(); datum != NULL; datum = cacheNext()) {
+        Value *cell = cons(datum, makeNull());
+        if (last == NULL) {
+            program = cell;
+        } else {
+            last->c.cdr = cell;
+            gcWriteBarrier(last);
+        }
+        last = cell;
+    }
+    return program;
+}
+
+static uint64_t hashSource(unsigned char *text, size_t length) {
+    uint64_t hash = 14695981039346656037UL;
+    size_t index = 0;
+    for (; index + 8 <= length; index += 8) {
+        uint64_t word;
+        memcpy(&word, text + index, 8);
+        hash ^= word;
+        hash *= 1099511628211UL;
+    }
+    for (; index < length; index++) {
+        hash ^= text[index];
+        hash *= 1099511628211UL;
+    }
+    return hash ^ length;
+}
+
+// Everything that can be checked before any of the program runs is: the
+// header, the size and the symbol table. The datums are checked as they are
+// decoded, and a damaged one ends the run.
+static int loadCache(uint64_t hash) {
+    int file = open(cachePath, O_RDONLY);
+    if (file < 0) {
+        return 0;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || (uint64_t)status.st_size < sizeof(CacheHeader) + 2) {
+        close(file);
+        return 0;
+    }
+    unsigned char *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    CacheHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, "SCMC", 4) != 0 || header.version != CACHE_VERSION
+        || header.hash != hash || header.size != (uint64_t)status.st_size
+        || map[status.st_size - 1] != TAG_END) {
+        munmap(map, status.st_size);
+        return 0;
+    }
+
+    cursor = map + sizeof(header);
+    limit = map + status.st_size;
+    // every name takes at least the byte of its length
+    uint64_t count = readNumber();
+    if (count > (uint64_t)(limit - cursor)) {
+        munmap(map, status.st_size);
+        cursor = NULL;
+        return 0;
+    }
+    symbols = malloc(sizeof(Value *) * (count + 1));
+    if (symbols == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    uint64_t interned = 0;
+    for (; interned < count; interned++) {
+        uint64_t length = readNumber();
+        if (length > (uint64_t)(limit - cursor)) {
+            break;
+        }
+        symbols[interned] = internLength((char *)cursor, length);
+        cursor += length;
+    }
+    if (interned < count || limit - cursor < 1) {
+        free(symbols);
+        munmap(map, status.st_size);
+        cursor = NULL;
+        return 0;
+    }
+    symbolsLoaded = count;
+    return 1;
+}
+
+// Decoding allocates but never reaches a safepoint, so the lists are built
+// in place like the reader builds them.
+static Value *readDatum() {
+    unsigned char tag = *cursor++;
+    switch (tag) {
+        case TAG_FIXNUM: {
+            uint64_t zigzag = readNumber();
+            return makeFixnum((long)(zigzag >> 1) ^ -(long)(zigzag & 1));
+        }
+
+        case TAG_DOUBLE: {
+            Value *value = tallocValue();
+            value->type = DOUBLE_TYPE;
+            readBytes(&value->d, sizeof(double));
+            return value;
+        }
+
+        case TAG_STRING: {
+            uint64_t length = readNumber();
+            if (length > (uint64_t)(limit - cursor)) {
+                damaged();
+            }
+            Value *value = tallocValue();
+            value->type = STR_TYPE;
+            value->s = talloc(length + 1);
+            readBytes(value->s, length);
+            value->s[length] = '\0';
+            return value;
+        }
+
+        case TAG_SYMBOL: {
+            uint64_t index = readNumber();
+            if (index >= symbolsLoaded) {
+                damaged();
+            }
+            return symbols[index];
+        }
+
+        case TAG_TRUE:
+            return makeBool(1);
+
+        case TAG_FALSE:
+            return makeBool(0);
+
+        case TAG_NULL:
+            return makeNull();
+
+        case TAG_LIST: {
+            uint64_t count = readNumber();
+            Value *list = makeNull();
+            Value *last = NULL;
+            for (uint64_t i = 0; i < count; i++) {
+                Value *cell = cons(readDatum(), makeNull());
+                if (last == NULL) {
+                    list = cell;
+                } else {
+                    last->c.cdr = cell;
+                    gcWriteBarrier(last);
+                }
+                last = cell;
+            }
+            return list;
+        }
+
+        case TAG_DOT:
+            return punctuation(DOT_TYPE);
+
+        case TAG_OPENBRACKET:
+            return punctuation(OPENBRACKET_TYPE);
+
+        case TAG_CLOSEBRACKET:
+            return punctuation(CLOSEBRACKET_TYPE);
+
+        default:
+            damaged();
+            return NULL;
+    }
+}
+
+static void readBytes(void *to, size_t count) {
+    if (count > (size_t)(limit - cursor)) {
+        damaged();
+    }
+    memcpy(to, cursor, count);
+    cursor += count;
+}
+
+static uint64_t readNumber() {
+    uint64_t number = 0;
+    for (int shift = 0; shift < 64 && cursor < limit; shift += 7) {
+        unsigned char byte = *cursor++;
+        number |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return number;
+        }
+    }
+    damaged();
+    return 0;
+}
+
+static void damaged() {
+    printf("Error: %s is damaged\n", cachePath);
+    texit(1);
+}
+
+// The reader only makes proper lists, so a list is written as its length
+// and elements.
+static void writeDatum(Value *datum) {
+    unsigned char tag;
+    switch (typeOf(datum)) {
+        case INT_TYPE: {
+            long number = fixnumValue(datum);
+            tag = TAG_FIXNUM;
+            writeBytes(&datums, &tag, 1);
+            writeNumber(&datums, ((uint64_t)number << 1) ^ (uint64_t)(number >> 63));
+            break;
+        }
+
+        case DOUBLE_TYPE:
+            tag = TAG_DOUBLE;
+            writeBytes(&datums, &tag, 1);
+            writeBytes(&datums, &datum->d, sizeof(double));
+            break;
+
+        case STR_TYPE: {
+            size_t length = strlen(datum->s);
+            tag = TAG_STRING;
+            writeBytes(&datums, &tag, 1);
+            writeNumber(&datums, length);
+            writeBytes(&datums, datum->s, length);
+            break;
+        }
+
+        case SYMBOL_TYPE: {
+            uint32_t index = symbolIndex(datum);
+            tag = TAG_SYMBOL;
+            writeBytes(&datums, &tag, 1);
+            writeNumber(&datums, index);
+            break;
+        }
+
+        case BOOL_TYPE:
+            tag = datum == FALSE_VALUE ? TAG_FALSE : TAG_TRUE;
+            writeBytes(&datums, &tag, 1);
+            break;
+
+        case NULL_TYPE:
+            tag = TAG_NULL;
+            writeBytes(&datums, &tag, 1);
+            break;
+
+        case CONS_TYPE: {
+            tag = TAG_LIST;
+            writeBytes(&datums, &tag, 1);
+            writeNumber(&datums, length(datum));
+            for (Value *curr = datum; typeOf(curr) == CONS_TYPE; curr = cdr(curr)) {
+                writeDatum(car(curr));
+            }
+            break;
+        }
+
+        case DOT_TYPE:
+            tag = TAG_DOT;
+            writeBytes(&datums, &tag, 1);
+            break;
+
+        case OPENBRACKET_TYPE:
+            tag = TAG_OPENBRACKET;
+            writeBytes(&datums, &tag, 1);
+            break;
+
+        default:
+            tag = TAG_CLOSEBRACKET;
+            writeBytes(&datums, &tag, 1);
+            break;
+    }
+}
+
+static void writeBytes(Buffer *buffer, void *from, size_t count) {
+    if (buffer->length + count > buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? 65536 : buffer->capacity * 2;
+        while (buffer->length + count > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->bytes = realloc(buffer->bytes, buffer->capacity);
+        if (buffer->bytes == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+    }
+    memcpy(buffer->bytes + buffer->length, from, count);
+    buffer->length += count;
+}
+
+static void writeNumber(Buffer *buffer, uint64_t number) {
+    unsigned char bytes[10];
+    int count = 0;
+    while (number >= 0x80) {
+        bytes[count++] = (unsigned char)(number & 0x7f) | 0x80;
+        number >>= 7;
+    }
+    bytes[count++] = (unsigned char)number;
+    writeBytes(buffer, bytes, count);
+}
+
+static uint32_t symbolIndex(Value *symbol) {
+    if (symbolCount * 2 >= indexCapacity) {
+        uint32_t oldCapacity = indexCapacity;
+        Value **oldKeys = indexKeys;
+        uint32_t *oldValues = indexValues;
+        indexCapacity = indexCapacity == 0 ? 256 : indexCapacity * 2;
+        indexKeys = calloc(indexCapacity, sizeof(Value *));
+        indexValues = malloc(sizeof(uint32_t) * indexCapacity);
+        if (indexKeys == NULL || indexValues == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            if (oldKeys[i] != NULL) {
+                uint32_t slot = ((uintptr_t)oldKeys[i] >> 4) & (indexCapacity - 1);
+                while (indexKeys[slot] != NULL) {
+                    slot = (slot + 1) & (indexCapacity - 1);
+                }
+                indexKeys[slot] = oldKeys[i];
+                indexValues[slot] = oldValues[i];
+            }
+        }
+        free(oldKeys);
+        free(oldValues);
+    }
+
+    uint32_t slot = ((uintptr_t)symbol >> 4) & (indexCapacity - 1);
+    while (indexKeys[slot] != NULL && indexKeys[slot] != symbol) {
+        slot = (slot + 1) & (indexCapacity - 1);
+    }
+    if (indexKeys[slot] == NULL) {
+        size_t length = strlen(symbol->s);
+        writeNumber(&names, length);
+        writeBytes(&names, symbol->s, length);
+        indexKeys[slot] = symbol;
+        indexValues[slot] = symbolCount++;
+    }
+    return indexValues[slot];
+}
+
+// The cache is written to a temporary file that is then renamed, so a
+// cache is either complete or absent. Failing to write it is not an error.
+static void writeCache() {
+    recording = 0;
+
+    // the symbol count goes in front of the names
+    Buffer count = {NULL, 0, 0};
+    writeNumber(&count, symbolCount);
+
+    CacheHeader header;
+    memcpy(header.magic, "SCMC", 4);
+    header.version = CACHE_VERSION;
+    header.hash = sourceHash;
+    header.size = sizeof(header) + count.length + names.length + datums.length + 1;
+    unsigned char end = TAG_END;
+
+    char *temporary = malloc(strlen(cachePath) + 32);
+    if (temporary == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    sprintf(temporary, "%s.%d", cachePath, (int)getpid());
+    FILE *out = fopen(temporary, "wb");
+    if (out != NULL) {
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(count.bytes, 1, count.length, out);
+        fwrite(names.bytes, 1, names.length, out);
+        fwrite(datums.bytes, 1, datums.length, out);
+        fwrite(&end, 1, 1, out);
+        if (fclose(out) != 0 || rename(temporary, cachePath) != 0) {
+            unlink(temporary);
+        }
+    }
+    free(temporary);
+    free(count.bytes);
+    free(names.bytes);
+    free(datums.bytes);
+}
@@ -0,0 +1,33 @@
+#include "value.h"
+
+#ifndef _CACHE
+#define _CACHE
+
+// A program read from a file can be cached next to it, in the file with a
+// "c" appended to its name (program.scm gets program.scmc). The cache holds
+// the datums of the program in a compact binary form along with a hash of
+// the source: first the name of every symbol, so they are all interned as
+// soon as it is loaded, then each top-level datum with its numbers and
+// strings stored inline. A cache whose hash does not match the source is
+// ignored and replaced.
+//
+// Forms come out of the cache one at a time, decoded from a mapping of the
+// file, so a program runs the same from its cache as from its source. The
+// cache is only written once the whole program has been read, so a run
+// that stops early (on an error) writes none.
+
+// Use the program in the file at path as stdin, and its cache if it has a
+// valid one.
+void cacheOpen(char *path);
+
+// Return the next top-level datum of the program, or NULL at its end. It
+// comes from the cache if there is one; otherwise it is read with
+// parseNext(), and if cacheOpen() was called, recorded in the cache that is
+// written when the end is reached.
+Value *cacheNext();
+
+// Return the list of every top-level datum of the program, read with
+// cacheNext().
+Value *cacheProgram();
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "talloc.h"
+#include "value.h"
+#include "interpreter.h"
+#include "closures.h"
+
+// What a frame's scan finds out about each of its slots.
+#define CAPTURED 1
+#define ASSIGNED 2
+
+// The variables a lambda being flattened captures, as VARIABLE_NODEs
+// resolved from the frame the lambda runs in.
+typedef struct {
+    Node **variables;
+    int count;
+    int capacity;
+} Captures;
+
+//Helper Functions
+//mark the references to boxed variables in node and everything under it
+static void markBoxes(Node *node);
+//record how node uses the slots of the frame depth levels up
+static void scanSlots(Node *node, int depth, int inLambda, unsigned char *uses);
+//set boxed on the references in node to boxed slots of the frame depth levels up
+static void markReferences(Node *node, int depth, unsigned char *uses);
+//resolve the references in node that leave the lambda being flattened
+static Node *flatten(Node *node, int depth, Captures *captures);
+//index in captures of the variable slot index of the frame depth levels out
+static int captureSlot(Captures *captures, Node *reference, int depth);
+
+Node *flattenClosures(Node *node){
+    markBoxes(node);
+    return flatten(node, 0, NULL);
+}
+
+// Each frame is scanned on its own while the references still count frames
+// through enclosing lambdas; flattening changes that.
+static void markBoxes(Node *node) {
+    if (node == NULL) {
+        return;
+    }
+    int makesFrame = node->kind == LET_NODE || node->kind == LETSTAR_NODE
+                     || node->kind == LETREC_NODE || node->kind == LAMBDA_NODE;
+    if (makesFrame && node->frameSize > 0) {
+        unsigned char *uses = calloc(node->frameSize, 1);
+        if (uses == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+        // letrec binds its variables after closures of them may exist
+        for (int i = 0; node->kind == LETREC_NODE && i < node->index; i++) {
+            uses[i] |= ASSIGNED;
+        }
+        for (int i = 0; i < node->count; i++) {
+            if (opensFrame(node, i)) {
+                scanSlots(node->children[i], 0, 0, uses);
+            }
+        }
+
+        int anyBoxed = 0;
+        for (int slot = 0; slot < node->frameSize; slot++) {
+            anyBoxed |= uses[slot] == (CAPTURED | ASSIGNED);
+        }
+        for (int i = 0; anyBoxed && i < node->count; i++) {
+            if (opensFrame(node, i)) {
+                markReferences(node->children[i], 0, uses);
+            }
+        }
+        free(uses);
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        markBoxes(node->children[i]);
+    }
+}
+
+static void scanSlots(Node *node, int depth, int inLambda, unsigned char *uses) {
+    if (node == NULL) {
+        return;
+    }
+    if ((node->kind == VARIABLE_NODE || node->kind == SET_NODE || node->kind == DEFINE_NODE)
+        && node->depth == depth) {
+        uses[node->index] |= (inLambda ? CAPTURED : 0) | (node->kind != VARIABLE_NODE ? ASSIGNED : 0);
+    }
+    for (int i = 0; i < node->count; i++) {
+        scanSlots(node->children[i], depth + opensFrame(node, i),
+                  inLambda || node->kind == LAMBDA_NODE, uses);
+    }
+}
+
+static void markReferences(Node *node, int depth, unsigned char *uses) {
+    if (node == NULL) {
+        return;
+    }
+    if ((node->kind == VARIABLE_NODE || node->kind == SET_NODE || node->kind == DEFINE_NODE)
+        && node->depth == depth && uses[node->index] == (CAPTURED | ASSIGNED)) {
+        node->boxed = 1;
+    }
+    for (int i = 0; i < node->count; i++) {
+        markReferences(node->children[i], depth + opensFrame(node, i), uses);
+    }
+}
+
+// depth counts the frames between node and the frame of the lambda being
+// flattened, whose captured frame is one further out. A lambda is flattened
+// inside out: its own captures are references from where it runs, which
+// the enclosing lambda may have to capture in turn. The node is replaced,
+// since it needs room for the captures.
+static Node *flatten(Node *node, int depth, Captures *captures) {
+    if (node == NULL) {
+        return NULL;
+    }
+    if ((node->kind == VARIABLE_NODE || node->kind == SET_NODE)
+        && captures != NULL && node->depth > depth) {
+        node->index = captureSlot(captures, node, node->depth - depth - 1);
+        node->depth = depth + 1;
+    }
+
+    if (node->kind == LAMBDA_NODE) {
+        Captures inner = {NULL, 0, 0};
+        Node *body = flatten(node->children[0], 0, &inner);
+        Node *lambda = makeNode(LAMBDA_NODE, node->value, 1 + inner.count);
+        lambda->index = node->index;
+        lambda->frameSize = node->frameSize;
+        lambda->children[0] = body;
+        for (int i = 0; i < inner.count; i++) {
+            lambda->children[i + 1] = flatten(inner.variables[i], depth, captures);
+        }
+        free(inner.variables);
+        return lambda;
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        node->children[i] = flatten(node->children[i], depth + opensFrame(node, i), captures);
+    }
+    return node;
+}
+
+static int captureSlot(Captures *captures, Node *reference, int depth) {
+    for (int i = 0; i < captures->count; i++) {
+        Node *variable = captures->variables[i];
+        if (variable->depth == depth && variable->index == reference->index) {
+            return i;
+        }
+    }
+
+    if (captures->count == captures->capacity) {
+        captures->capacity = captures->capacity == 0 ? 8 : captures->capacity * 2;
+        captures->variables = realloc(captures->variables, sizeof(Node *) * captures->capacity);
+        if (captures->variables == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+    }
+    Node *variable = makeNode(VARIABLE_NODE, reference->value, 0);
+    variable->depth = depth;
+    variable->index = reference->index;
+    variable->boxed = reference->boxed;
+    captures->variables[captures->count] = variable;
+    return captures->count++;
+}
@@ -0,0 +1,15 @@
+#include "value.h"
+
+#ifndef _CLOSURES
+#define _CLOSURES
+
+// Turn the lambdas of an analyzed top-level form into flat closures and
+// return the form to run. Each LAMBDA_NODE gets a capture child for every
+// variable its body uses from the frames around it, and the references in
+// the body are resolved to the captured frame instead of the enclosing ones.
+// A captured variable that is ever assigned (by set!, a define or a letrec)
+// is marked boxed, so that its frame and the closures share one box. Runs
+// after any optimization, which relies on the frames being nested.
+Node *flattenClosures(Node *node);
+
+#endif
@@ -2,672 +2,1465 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "tokenizer.h"
 #include "value.h"
+#include "symbol.h"
 #include "interpreter.h"
+#include "vm.h"
+#include "optimizer.h"
+#include "closures.h"
+#include "jit.h"
+#include "cache.h"
+
+// Interned names of the special forms, compared by pointer in analyze()
+static Value *quoteSymbol, *ifSymbol, *letSymbol, *letStarSymbol, *letrecSymbol,
+    *setSymbol, *beginSymbol, *displaySymbol, *defineSymbol, *lambdaSymbol,
+    *andSymbol, *orSymbol, *condSymbol, *elseSymbol;
+
+// The frame of top-level definitions, registered as a global root
+static Frame *globalFrame = NULL;
+
+// Compile-time picture of a local frame: the variable named in each slot.
+// Analysis keeps one per lambda, let, let* and letrec on the C stack; a NULL
+// scope stands for the global frame.
+typedef struct Scope {
+    Value **names;
+    int count;
+    int capacity;
+    struct Scope *parent;
+} Scope;
 
 //Helper Functions
-//look up the value of the symbol in the frame
-Value *lookUpSymbol(Value *tree, Frame *frame);
-//evaluate if expression
-Value *evalIf(Value *args, Frame *frame);
-//evaluate let&let* expression
-Value *evalLet(Value *args, Frame *frame, Frame *(*frameOperation)(Value *, Frame *));
-//evaluate letrec expression
-Value *evalLetrec(Value *args, Frame *frame);
-//evaluate Define expression
-Value *evalDefine(Value *args, Frame *frame);
-//evaluate Lambda expression
-Value *evalLambda(Value *args, Frame *frame);
-//evaluate set! expression
-Value *evalSet(Value *args, Frame *frame);
-//evaluate set! expression
-Value *evalBegin(Value *args, Frame *frame);
-//evaluate and expression
-Value *evalAnd(Value *args, Frame *frame);
-//evaluate or expression
-Value *evalOr(Value *args, Frame *frame);
-//evaluate cond expression
-Value *evalCond(Value *args, Frame *frame);
-
-//create a new frame and add binding to the let expression
-Frame *createFrame(Value *bindingHead, Frame *parentFrame);
-//print the evaluation result
-void printEvalResult(Value *result);
-//apply the user define functions
-Value *apply(Value *function, Value *args);
-//add a new binding to the frame
+//run every top-level form of a whole program in order, optimized
+void interpretProgram(Value *tree, evaluatorKind evaluator);
+//intern the names of the special forms
+void internSpecialForms();
+//start an empty scope nested in parent
+void openScope(Scope *scope, Scope *parent);
+//release the memory of a scope
+void closeScope(Scope *scope);
+//give a name the next slot of a scope
+int declare(Scope *scope, Value *name);
+//slot of the innermost variable with the given name in a scope, or -1
+int findSlot(Scope *scope, Value *name);
+//set depth and index of a node to the variable name refers to
+void resolve(Node *node, Value *name, Scope *scope);
+//declare the names a body defines, so references before the define find them
+void declareDefines(Value *expr, Scope *scope);
+//analyze an expression that will run in a frame described by scope
+Node *analyzeExpr(Value *expr, Scope *scope);
+//node that reports an evaluation error when it is run
+Node *analyzeError(char *message);
+//analyze every expression in a list into the children of one node
+Node *analyzeSequence(nodeKind kind, Value *expressions, Scope *scope);
+//analyze if expression
+Node *analyzeIf(Value *args, Scope *scope);
+//analyze let expression
+Node *analyzeLet(Value *args, Scope *scope);
+//analyze let* expression
+Node *analyzeLetStar(Value *args, Scope *scope);
+//analyze letrec expression
+Node *analyzeLetrec(Value *args, Scope *scope);
+//analyze Define expression
+Node *analyzeDefine(Value *args, Scope *scope);
+//analyze Lambda expression
+Node *analyzeLambda(Value *args, Scope *scope);
+//analyze set! expression
+Node *analyzeSet(Value *args, Scope *scope);
+//analyze cond expression
+Node *analyzeCond(Value *args, Scope *scope);
+//analyze a procedure call
+Node *analyzeCall(Value *first, Value *args, Scope *scope);
+//fast path for a two-operand call of the named global
+fastPath fastPathFor(Value *name);
+//check the bindings of a let, let* or letrec and return their names
+Value *bindingNames(Value *bindingsHead, int checkDuplicates, char **error);
+
+//run an analyzed node on the evaluation machine
+Value *execute(Node *node, Frame *frame);
+//allocate the stacks of the evaluation machine
+void initStacks();
+//move the value stack to a block twice the size
+void growValues();
+//move the continuation stack to a block twice the size
+void growContinuations();
+//make a frame of count slots inside parent
+Frame *newFrame(int count, Frame *parent);
+//value of a local variable
+Value *lookUpLocal(Node *node, Frame *frame);
+//value of a global variable
+Value *lookUpGlobal(Node *node);
+//nonzero for a node whose value takes no evaluation step: a constant or variable
+int isSimple(Node *node);
+//value of a simple node
+Value *simpleValue(Node *node, Frame *frame);
+
+//make the frame of a call to a user defined function
+Frame *callFrame(Value *function, int argc, Value **argv);
+//call a closure with the tree evaluator and return its value
+Value *applyClosure(Value *closure, int argc, Value **argv);
+//add a new binding to the global frame
 void addBinding(Value *key, Value *value, Frame *frame);
-//create frame for let*
-Frame *createLinkedFrames(Value *bindingsHead, Frame *parentFrame);
+//nonzero when every argument is a fixnum or a double
+int allNumbers(int argc, Value **argv);
+//find the binding cons cell of a symbol in a frame's hash table
+Value *findTableBinding(Value *key, Frame *frame);
+//home slot of a symbol in a hash table with the given mask
+int tableSlot(Value *key, int mask);
+//insert a binding cons cell into a frame's hash table
+void insertTableBinding(Value *binding, Frame *frame);
 
 // Potential bug in struct Value *
-void bindPrimitiveFn(char *name, Value *(*function)(Value *), Frame *frame);
+void bindPrimitiveFn(char *name, Value *(*function)(int, Value **), Frame *frame);
 //primitiveFunctions
-Value *primitivePlus(Value *args);
-Value *primitiveMinus(Value *args);
-Value *primitiveNull(Value *args);
-Value *primitiveCar(Value *args);
-Value *primitiveCdr(Value *args);
-Value *primitiveCons(Value *args);
-Value *primitiveBigger(Value *args);
-Value *primitiveSmaller(Value *args);
-Value *primitiveEqual(Value *args);
-Value *primitiveMultiple(Value *args);
-Value *primitiveDivide(Value *args);
-Value *primitiveModulo(Value *args);
-
-void interpret(Value *tree) {
-    Frame *topLevel = talloc(sizeof(Frame));
-    topLevel->bindings = makeNull();
-    topLevel->parent = NULL;
+Value *primitivePlus(int argc, Value **argv);
+Value *primitiveMinus(int argc, Value **argv);
+Value *primitiveNull(int argc, Value **argv);
+Value *primitiveCar(int argc, Value **argv);
+Value *primitiveCdr(int argc, Value **argv);
+Value *primitiveCons(int argc, Value **argv);
+Value *primitiveBigger(int argc, Value **argv);
+Value *primitiveSmaller(int argc, Value **argv);
+Value *primitiveEqual(int argc, Value **argv);
+Value *primitiveMultiple(int argc, Value **argv);
+Value *primitiveDivide(int argc, Value **argv);
+Value *primitiveModulo(int argc, Value **argv);
+//compare adjacent numeric arguments for >, < and =
+Value *compareNumbers(int argc, Value **argv, char *name, int (*compare)(int));
+//-1, 0 or 1 as number a is less than, equal to or greater than b; 2 for NaN
+int numberOrder(Value *a, Value *b);
+//orderings compareNumbers checks
+int isBigger(int order);
+int isSmaller(int order);
+int isEqual(int order);
+
+// A node waiting for the value of one of its subexpressions: step says
+// which, and base is where the node's frame is saved in the value stack. The
+// values the node has collected so far, such as evaluated operands, are
+// above it. mark is the top of the frame stack when the node stopped: every
+// frame made since belongs to the subexpression and is dead once it has a
+// value.
+typedef struct Continuation {
+    Node *node;
+    int step;
+    int base;
+    void *mark;
+} Continuation;
+
+// The stacks of the evaluation machine (see execute). Both are raw blocks in
+// the old generation kept alive as global roots. The collector traces the
+// value stack up to valuesTop; continuations only point at nodes, which never
+// move.
+static Value **values = NULL;
+static Value **valuesTop = NULL;
+static Value **valuesLimit = NULL;
+static Continuation *continuations = NULL;
+static int continuationCount = 0;
+static int continuationCapacity = 0;
+
+ALWAYS_INLINE void pushValue(Value *value) {
+    if (valuesTop == valuesLimit) {
+        growValues();
+    }
+    *valuesTop++ = value;
+}
 
-    // bind primitive functions
-    bindPrimitiveFn("+", primitivePlus, topLevel);
-    bindPrimitiveFn("-", primitiveMinus, topLevel);
-    bindPrimitiveFn("*", primitiveMultiple, topLevel);
-    bindPrimitiveFn("/", primitiveDivide, topLevel);
-    bindPrimitiveFn("<", primitiveSmaller, topLevel);
-    bindPrimitiveFn(">", primitiveBigger, topLevel);
-    bindPrimitiveFn("=", primitiveEqual, topLevel);
-    bindPrimitiveFn("modulo", primitiveModulo, topLevel);
-    bindPrimitiveFn("null?", primitiveNull, topLevel);
-    bindPrimitiveFn("car", primitiveCar, topLevel);
-    bindPrimitiveFn("cdr", primitiveCdr, topLevel);
-    bindPrimitiveFn("cons", primitiveCons, topLevel);
-    
+// Save node, the step it is at and its frame until a subexpression has a
+// value.
+ALWAYS_INLINE void pushContinuation(Node *node, int step, Frame *frame) {
+    if (continuationCount == continuationCapacity) {
+        growContinuations();
+    }
+    Continuation *continuation = &continuations[continuationCount++];
+    continuation->node = node;
+    continuation->step = step;
+    continuation->base = (int)(valuesTop - values);
+    continuation->mark = frameStackMark();
+    pushValue((Value *)frame);
+}
 
-    for (Value *curr = tree; curr->type == CONS_TYPE; curr = cdr(curr)) {
-        if (car(curr)->type == SINGLEQUOTE_TYPE){
-            curr = cdr(curr);
-            printEvalResult(car(curr));
-        }else{
-            Value *result = eval(car(curr), topLevel);
-            printEvalResult(result);
+// Drop the newest continuation with its frame and collected values.
+ALWAYS_INLINE void popContinuation() {
+    continuationCount--;
+    valuesTop = values + continuations[continuationCount].base;
+}
+
+void interpret(evaluatorKind evaluator, int optimize, int jit) {
+    initGlobalFrame();
+    jitInit(jit, evaluator == BYTECODE_EVALUATOR ? vmApply : applyClosure);
+    if (optimize) {
+        interpretProgram(cacheProgram(), evaluator);
+        return;
+    }
+
+    // Each form is analyzed and run as soon as it has been read, so only the
+    // form being run and what the program keeps need memory. The nodes of a
+    // form stay alive as long as closures made from them do. Unless stdin is
+    // a file, more input may be a while coming, so each result is flushed.
+    struct stat input;
+    int flush = fstat(0, &input) != 0 || !S_ISREG(input.st_mode);
+    Value *datum = NULL;
+    Node *node = NULL;
+    gcPushRoot(&datum);
+    gcPushRoot(&node);
+    internSpecialForms();
+    while ((datum = cacheNext()) != NULL) {
+        node = flattenClosures(analyze(datum));
+        if (evaluator == BYTECODE_EVALUATOR) {
+            // the machine only stops at calls, which a form may not make
+            gcSafepoint();
+            printEvalResult(vmExecute(node, globalFrame));
+        } else {
+            printEvalResult(execute(node, globalFrame));
+        }
+        if (flush) {
+            fflush(stdout);
         }
     }
+    gcPopRoots(2);
 }
 
-Value *eval(Value *tree, Frame *frame) {
-    switch (tree->type)  {
-        case INT_TYPE:
-            return tree;
+// The optimizer works on the whole program, so every form is read and
+// analyzed before any of them runs.
+void interpretProgram(Value *tree, evaluatorKind evaluator) {
+    // Nodes are allocated in the old generation and never move. Every node is
+    // reachable from the analyzed top-level form it came from, so keeping the
+    // whole program rooted keeps all code alive while closures still run it.
+    Node **program = (Node **)tallocArray(length(tree));
+    gcPushRoot(&tree);
+    gcPushRoot(&program);
+    analyzeProgram(tree, program, 1);
+
+    int form = 0;
+    for (Value *curr = tree; typeOf(curr) == CONS_TYPE; curr = cdr(curr), form++) {
+        Value *result;
+        if (evaluator == BYTECODE_EVALUATOR) {
+            gcSafepoint();
+            result = vmExecute(program[form], globalFrame);
+        } else {
+            result = execute(program[form], globalFrame);
+        }
+        printEvalResult(result);
+    }
 
-        case DOUBLE_TYPE:
-            return tree;
+    gcPopRoots(2);
+}
+
+Frame *initGlobalFrame() {
+    globalFrame = tallocFrame(0);
+    globalFrame->parent = NULL;
+    globalFrame->tableCapacity = 64;
+    globalFrame->table = (Value **)tallocArray(globalFrame->tableCapacity);
+    gcAddGlobalRoot(&globalFrame);
+
+    // bind primitive functions
+    bindPrimitiveFn("+", primitivePlus, globalFrame);
+    bindPrimitiveFn("-", primitiveMinus, globalFrame);
+    bindPrimitiveFn("*", primitiveMultiple, globalFrame);
+    bindPrimitiveFn("/", primitiveDivide, globalFrame);
+    bindPrimitiveFn("<", primitiveSmaller, globalFrame);
+    bindPrimitiveFn(">", primitiveBigger, globalFrame);
+    bindPrimitiveFn("=", primitiveEqual, globalFrame);
+    bindPrimitiveFn("modulo", primitiveModulo, globalFrame);
+    bindPrimitiveFn("null?", primitiveNull, globalFrame);
+    bindPrimitiveFn("car", primitiveCar, globalFrame);
+    bindPrimitiveFn("cdr", primitiveCdr, globalFrame);
+    bindPrimitiveFn("cons", primitiveCons, globalFrame);
+    return globalFrame;
+}
+
+// The whole program is analyzed before any of it runs, so the optimizer can
+// see every global the program defines. The parse tree is walked across
+// safepoints, so it is promoted out of the nursery up front.
+void analyzeProgram(Value *tree, Node **program, int optimize) {
+    gcPushRoot(&tree);
+    gcPushRoot(&program);
+    gcCollectMinor();
+    internSpecialForms();
+
+    int count = 0;
+    for (Value *curr = tree; typeOf(curr) == CONS_TYPE; curr = cdr(curr), count++) {
+        program[count] = analyze(car(curr));
+        gcWriteBarrier(program);
+    }
+    if (optimize) {
+        optimizeProgram(program, count, globalFrame);
+        gcWriteBarrier(program);
+    }
+    for (int form = 0; form < count; form++) {
+        program[form] = flattenClosures(program[form]);
+    }
+    gcWriteBarrier(program);
+    gcPopRoots(2);
+}
+
+// Analyze expr as top-level code and run it; frame must be the global frame.
+Value *eval(Value *expr, Frame *frame) {
+    Node *node = flattenClosures(analyze(expr));
+    gcPushRoot(&node);
+    Value *result = execute(node, frame);
+    gcPopRoots(1);
+    return result;
+}
 
+Node *analyze(Value *expr) {
+    return analyzeExpr(expr, NULL);
+}
+
+// Analysis allocates but never runs code, so no collection can happen while
+// a node tree is being built.
+Node *analyzeExpr(Value *expr, Scope *scope) {
+    switch (typeOf(expr))  {
+        case INT_TYPE:
+        case DOUBLE_TYPE:
         case STR_TYPE:
-            return tree;
-    
         case BOOL_TYPE:
-            return tree;
-     
+            return makeNode(CONSTANT_NODE, expr, 0);
+
         case SYMBOL_TYPE: {
-            Value *result = lookUpSymbol(tree, frame);
-            // If symbol's value cannot be found
-            if (result == NULL) {
-                printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
-                texit(0);
-            } else {
-                return result;
-            }
+            Node *node = makeNode(VARIABLE_NODE, expr, 0);
+            resolve(node, expr, scope);
+            return node;
         }
 
         case CONS_TYPE: {
-            Value *first = car(tree);
-            Value *args = cdr(tree);
-            
-            if (!strcmp(first->s, "quote") || first->type == SINGLEQUOTE_TYPE){
+            Value *first = car(expr);
+            Value *args = cdr(expr);
+            if (first == quoteSymbol){
                 if (length(args) != 1){
-                    printf("Evaluation error: quote only allows one parameter\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: quote only allows one parameter");
                 }
-                
-                return car(args);                
 
-            } else if (first->type != SYMBOL_TYPE && first->type != CONS_TYPE) {
+                return makeNode(CONSTANT_NODE, car(args), 0);
+
+            } else if (typeOf(first) != SYMBOL_TYPE && typeOf(first) != CONS_TYPE) {
                 // Sanity and error checking on first
-                printf("Evaluation error: first item is not symbol type in s-expression\n");
-                texit(0);
+                return analyzeError("Evaluation error: first item is not symbol type in s-expression");
 
-            } else if (!strcmp(first->s, "if")) {
+            } else if (first == ifSymbol) {
                 if (length(args) != 3) {
-                    printf("Evaluation error: if expression must have 3 arguments\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: if expression must have 3 arguments");
                 }
-                return evalIf(args,frame);
-            
-            } else if (!strcmp(first->s, "let")) {
+                return analyzeIf(args, scope);
+
+            } else if (first == letSymbol) {
                 if (length(args) < 2) {
-                    printf("Evaluation error: let expression must have 2 arguments\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: let expression must have 2 arguments");
                 }
-                
-                return evalLet(args, frame, createFrame);
-                
-            } else if (!strcmp(first->s, "let*")) {
+
+                return analyzeLet(args, scope);
+
+            } else if (first == letStarSymbol) {
                 if (length(args) < 2) {
-                    printf("Evaluation error: let* expression must have 2 arguments\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: let* expression must have 2 arguments");
                 }
-                
-                return evalLet(args, frame, createLinkedFrames);
-                
-            } else if (!strcmp(first->s, "letrec")) {
+
+                return analyzeLetStar(args, scope);
+
+            } else if (first == letrecSymbol) {
                 if (length(args) < 2) {
-                    printf("Evaluation error: letrec expression must have 2 arguments\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: letrec expression must have 2 arguments");
                 }
-                
-                return evalLetrec(args, frame);
-                
-            } else if (!strcmp(first->s, "set!")) {
+
+                return analyzeLetrec(args, scope);
+
+            } else if (first == setSymbol) {
                 if (length(args) != 2) {
-                    printf("Evaluation error: set! expression must have 2 arguments\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: set! expression must have 2 arguments");
                 }
-                
-                return evalSet(args, frame);
-                
-            } else if (!strcmp(first->s, "begin")) {
-                                
-                return evalBegin(args, frame);
-                
-            } else if (!strcmp(first->s, "display")){
+
+                return analyzeSet(args, scope);
+
+            } else if (first == beginSymbol) {
+
+                return analyzeSequence(BEGIN_NODE, args, scope);
+
+            } else if (first == displaySymbol){
                 if (length(args) != 1){
-                    printf("Evaluation error: display only allows one parameter\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: display only allows one parameter");
                 }
-                
-                return eval(car(args), frame);
 
-            } else if (!strcmp(first->s, "define")){
+                return analyzeExpr(car(args), scope);
+
+            } else if (first == defineSymbol){
                 if (length(args) != 2) {
-                    printf("Evaluation error: define only allows two parameters\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: define only allows two parameters");
                 }
-                
-                return evalDefine(args, frame);
 
-            } else if (!strcmp(first->s, "lambda")){
+                return analyzeDefine(args, scope);
+
+            } else if (first == lambdaSymbol){
                 if (length(args) != 2) {
-                    printf("Evaluation error: lambda only allows two parameters\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: lambda only allows two parameters");
                 }
-                
-                return evalLambda(args, frame);
 
-            } else if (!strcmp(first->s, "and")){
-                
-                return evalAnd(args, frame);
+                return analyzeLambda(args, scope);
 
-            } else if (!strcmp(first->s, "or")){
+            } else if (first == andSymbol){
 
-                return evalOr(args, frame);
+                return analyzeSequence(AND_NODE, args, scope);
 
-            } else if (!strcmp(first->s, "cond")){
+            } else if (first == orSymbol){
+
+                return analyzeSequence(OR_NODE, args, scope);
+
+            } else if (first == condSymbol){
                 if (length(args) == 0){
-                    printf("Evaluation error: cond needs at least one parameter\n");
-                    texit(0);
+                    return analyzeError("Evaluation error: cond needs at least one parameter");
                 }
-                
-                return evalCond(args, frame);
 
-            } else {
-                Value *currProcedure = eval(first, frame);
-                //args should be a flat list
-                Value *arguments = makeNull();
-                for (Value *currArg = args; currArg->type != NULL_TYPE; currArg = cdr(currArg)){
-                    arguments = cons(eval(car(currArg), frame), arguments);
-                }
+                return analyzeCond(args, scope);
 
-                if (currProcedure->type == CLOSURE_TYPE) {
-                    return apply(currProcedure, reverse(arguments));
-                } else if (currProcedure->type == PRIMITIVE_TYPE){
-                    return (currProcedure->primFn)(reverse(arguments));
-                } else {
-                    printf("Evaluation error: undefined procedure\n");
-                    texit(0);
-                }
+            } else {
+                return analyzeCall(first, args, scope);
             }
-            break;
         }
 
         default:
-            break;
-    }    
-    return NULL;
+            // anything else evaluates to nothing, as it always has
+            return makeNode(CONSTANT_NODE, NULL, 0);
+    }
 }
 
-Value *lookUpSymbol(Value *tree, Frame *frame) {
-    for (Frame *currFrame = frame; currFrame != NULL; currFrame = currFrame->parent) {
-        for (Value *bindingsHead = currFrame->bindings; bindingsHead->type == CONS_TYPE; bindingsHead = cdr(bindingsHead)) {
-            Value *bindingCons = car(bindingsHead);
-            // car(bindingCons) is the key cdr(bindingCons) is the value
-            if (!strcmp(car(bindingCons)->s, tree->s)) {
-                return cdr(bindingCons);
-            }
+// Interned symbols never move, so plain statics can hold them.
+void internSpecialForms() {
+    quoteSymbol = intern("quote");
+    ifSymbol = intern("if");
+    letSymbol = intern("let");
+    letStarSymbol = intern("let*");
+    letrecSymbol = intern("letrec");
+    setSymbol = intern("set!");
+    beginSymbol = intern("begin");
+    displaySymbol = intern("display");
+    defineSymbol = intern("define");
+    lambdaSymbol = intern("lambda");
+    andSymbol = intern("and");
+    orSymbol = intern("or");
+    condSymbol = intern("cond");
+    elseSymbol = intern("else");
+}
+
+void openScope(Scope *scope, Scope *parent){
+    scope->names = NULL;
+    scope->count = 0;
+    scope->capacity = 0;
+    scope->parent = parent;
+}
+
+void closeScope(Scope *scope){
+    free(scope->names);
+    scope->names = NULL;
+}
+
+int declare(Scope *scope, Value *name){
+    if (scope->count == scope->capacity) {
+        scope->capacity = scope->capacity == 0 ? 8 : scope->capacity * 2;
+        scope->names = realloc(scope->names, sizeof(Value *) * scope->capacity);
+    }
+    scope->names[scope->count] = name;
+    return scope->count++;
+}
+
+// Search from the last slot, so a let* binding shadows an earlier one.
+int findSlot(Scope *scope, Value *name){
+    for (int i = scope->count - 1; i >= 0; i--) {
+        if (scope->names[i] == name) {
+            return i;
         }
     }
-    return NULL;
+    return -1;
 }
 
-Value *evalIf(Value *args, Frame *frame) {
-    Value *condition = eval(car(args), frame);
-    
-    if (condition->type != BOOL_TYPE){
-        printf("Evaluation error: condition of an if expression must be a boolean\n");
-        texit(0);
+// Names not bound by any enclosing scope are globals, looked up by name when
+// they run.
+void resolve(Node *node, Value *name, Scope *scope){
+    int depth = 0;
+    for (Scope *curr = scope; curr != NULL; curr = curr->parent, depth++) {
+        int slot = findSlot(curr, name);
+        if (slot >= 0) {
+            node->depth = depth;
+            node->index = slot;
+            return;
+        }
     }
+    node->depth = -1;
+    node->index = -1;
+}
 
-    if (condition->i == 1){
-        return eval(car(cdr(args)), frame);
-    } else {
-        return eval(car(cdr(cdr(args))), frame);
+// A define anywhere in a body binds in the body's frame. Only the defines at
+// the top of the body (or of a begin there) are declared ahead of time; any
+// other define gets its slot when the analyzer reaches it.
+void declareDefines(Value *expr, Scope *scope){
+    if (typeOf(expr) != CONS_TYPE) {
+        return;
+    }
+    if (car(expr) == beginSymbol) {
+        for (Value *curr = cdr(expr); typeOf(curr) == CONS_TYPE; curr = cdr(curr)) {
+            declareDefines(car(curr), scope);
+        }
+    } else if (car(expr) == defineSymbol && typeOf(cdr(expr)) == CONS_TYPE) {
+        Value *name = car(cdr(expr));
+        if (typeOf(name) == CONS_TYPE) {
+            name = car(name);
+        }
+        if (typeOf(name) == SYMBOL_TYPE && findSlot(scope, name) < 0) {
+            declare(scope, name);
+        }
+    }
+}
+
+// Code lives as long as the program, so nodes go straight to the old
+// generation.
+Node *makeNode(nodeKind kind, Value *value, int count){
+    Node *node = tallocTenured(sizeof(Node) + sizeof(Node *) * count, NODE_KIND);
+    node->kind = kind;
+    node->count = count;
+    node->value = value;
+    // the datum may still be in the nursery
+    if (value != NULL && !isImmediate(value)) {
+        gcWriteBarrier(node);
+    }
+    return node;
+}
+
+Node *analyzeError(char *message){
+    Value *text = tallocValue();
+    text->type = STR_TYPE;
+    text->s = talloc(strlen(message) + 1);
+    strcpy(text->s, message);
+    return makeNode(ERROR_NODE, text, 0);
+}
+
+Node *analyzeSequence(nodeKind kind, Value *expressions, Scope *scope){
+    Node *node = makeNode(kind, NULL, length(expressions));
+    int i = 0;
+    for (Value *curr = expressions; !isNull(curr); curr = cdr(curr), i++) {
+        node->children[i] = analyzeExpr(car(curr), scope);
     }
+    return node;
 }
 
-Value *evalLet(Value *args, Frame *frame, Frame *(*frameOperation)(Value *, Frame *)){
-    Value *result = NULL;
-    if (car(args)->type == CONS_TYPE || car(args)->type == NULL_TYPE){
+Node *analyzeIf(Value *args, Scope *scope){
+    Node *node = makeNode(IF_NODE, NULL, 3);
+    node->children[0] = analyzeExpr(car(args), scope);
+    node->children[1] = analyzeExpr(car(cdr(args)), scope);
+    node->children[2] = analyzeExpr(car(cdr(cdr(args))), scope);
+    return node;
+}
 
-        if (car(args)->type == CONS_TYPE) {
-            frame = frameOperation(car(args), frame);
+// Returns NULL and sets error when the bindings are malformed.
+Value *bindingNames(Value *bindingsHead, int checkDuplicates, char **error){
+    Value *names = makeNull();
+    for (Value *currBinding = bindingsHead; typeOf(currBinding) == CONS_TYPE; currBinding = cdr(currBinding)){
+        if (typeOf(car(currBinding)) != CONS_TYPE) {
+            *error = "Evaluation error: bad format in let";
+            return NULL;
+        }
+        if (length(car(currBinding)) != 2){
+            *error = "Evaluation error: invalid number of keys and bindings";
+            return NULL;
         }
 
-        for (Value *currExpr = cdr(args); currExpr->type != NULL_TYPE; currExpr = cdr(currExpr)) {
-            result = eval(car(currExpr), frame);
+        Value *key = car(car(currBinding));
+        if (typeOf(key) != SYMBOL_TYPE){
+            *error = "Evaluation error: left side of a let pair doesn't have a variable.";
+            return NULL;
         }
-    } else {
-        printf("Evaluation error: the first argument of let must be a nested list\n");
-        texit(0);
+        for (Value *name = names; checkDuplicates && !isNull(name); name = cdr(name)) {
+            if (car(name) == key) {
+                *error = "Evaluation error: duplicate variable in let";
+                return NULL;
+            }
+        }
+        names = cons(key, names);
     }
-    return result;
+    return reverse(names);
 }
 
-Value *evalLetrec(Value *args, Frame *frame) {
-    Value *expressions = makeNull();
+// A let without bindings runs its body in the enclosing frame.
+Node *analyzeLet(Value *args, Scope *scope){
     Value *bindingsHead = car(args);
-    Value *result = NULL;
-    Frame *newFrame = talloc(sizeof(Frame));
-    newFrame->bindings = makeNull();
-    newFrame->parent = frame;
-
-    //error checking
-    if (car(args)->type != CONS_TYPE && car(args)->type != NULL_TYPE){
-        printf("Evaluation error: the first argument of letrec must be a nested list\n");
-        texit(0);
+    if (typeOf(bindingsHead) != CONS_TYPE && typeOf(bindingsHead) != NULL_TYPE){
+        return analyzeError("Evaluation error: the first argument of let must be a nested list");
+    }
+    if (isNull(bindingsHead)) {
+        return analyzeSequence(BEGIN_NODE, cdr(args), scope);
     }
 
-    //check e1 to en
-    for (Value *curr = bindingsHead; curr->type != NULL_TYPE; curr = cdr(curr)){
-        expressions = cons(eval(car(cdr(car(curr))), newFrame), expressions);
+    char *error = NULL;
+    Value *names = bindingNames(bindingsHead, 1, &error);
+    if (names == NULL) {
+        return analyzeError(error);
     }
 
-    //create new frame
-    expressions = reverse(expressions);
+    int count = length(names);
+    Node *node = makeNode(LET_NODE, names, count + length(cdr(args)));
+    node->index = count;
+    int i = 0;
+    for (Value *currBinding = bindingsHead; typeOf(currBinding) == CONS_TYPE; currBinding = cdr(currBinding), i++){
+        node->children[i] = analyzeExpr(car(cdr(car(currBinding))), scope);
+    }
 
-    //add bindings
-    for (Value *curr = bindingsHead; curr->type != NULL_TYPE; curr = cdr(curr), expressions = cdr(expressions)){
-        Value *key = car(car(curr));
-        if (key->type != SYMBOL_TYPE){
-            printf("Evaluation error: left side of a let pair doesn't have a variable.\n");
-            texit(0);
-        } else if (lookUpSymbol(key, newFrame) == NULL){
-            addBinding(key, car(expressions), newFrame);
-            
-        } else {
-            printf("Evaluation error: duplicate variable in let\n");
-            texit(0);
-        }
+    Scope inner;
+    openScope(&inner, scope);
+    for (Value *name = names; !isNull(name); name = cdr(name)) {
+        declare(&inner, car(name));
     }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr)) {
+        declareDefines(car(currExpr), &inner);
+    }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr), i++) {
+        node->children[i] = analyzeExpr(car(currExpr), &inner);
+    }
+    node->frameSize = inner.count;
+    closeScope(&inner);
+    return node;
+}
 
-    //evaluate body
-    for (Value *currExpr = cdr(args); currExpr->type != NULL_TYPE; currExpr = cdr(currExpr)) {
-        result = eval(car(currExpr), newFrame);
-        //printf("Here\n");
+// All bindings of a let* share one frame. Each gets a slot of its own as soon
+// as its initializer has been analyzed, so a later binding of the same name
+// shadows the earlier one and initializers only see the bindings before them.
+Node *analyzeLetStar(Value *args, Scope *scope){
+    Value *bindingsHead = car(args);
+    if (typeOf(bindingsHead) != CONS_TYPE && typeOf(bindingsHead) != NULL_TYPE){
+        return analyzeError("Evaluation error: the first argument of let must be a nested list");
+    }
+    if (isNull(bindingsHead)) {
+        return analyzeSequence(BEGIN_NODE, cdr(args), scope);
     }
 
-    return result;
+    char *error = NULL;
+    Value *names = bindingNames(bindingsHead, 0, &error);
+    if (names == NULL) {
+        return analyzeError(error);
+    }
+
+    int count = length(names);
+    Node *node = makeNode(LETSTAR_NODE, names, count + length(cdr(args)));
+    node->index = count;
+
+    Scope inner;
+    openScope(&inner, scope);
+    int i = 0;
+    for (Value *currBinding = bindingsHead; typeOf(currBinding) == CONS_TYPE; currBinding = cdr(currBinding), i++){
+        Value *key = car(car(currBinding));
+        Node *init = analyzeExpr(car(cdr(car(currBinding))), &inner);
+        Node *binding = makeNode(DEFINE_NODE, key, 1);
+        binding->depth = 0;
+        binding->index = declare(&inner, key);
+        binding->children[0] = init;
+        node->children[i] = binding;
+    }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr)) {
+        declareDefines(car(currExpr), &inner);
+    }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr), i++) {
+        node->children[i] = analyzeExpr(car(currExpr), &inner);
+    }
+    node->frameSize = inner.count;
+    closeScope(&inner);
+    return node;
+}
+
+Node *analyzeLetrec(Value *args, Scope *scope){
+    Value *bindingsHead = car(args);
+    if (typeOf(bindingsHead) != CONS_TYPE && typeOf(bindingsHead) != NULL_TYPE){
+        return analyzeError("Evaluation error: the first argument of letrec must be a nested list");
+    }
+
+    char *error = NULL;
+    Value *names = bindingNames(bindingsHead, 1, &error);
+    if (names == NULL) {
+        return analyzeError(error);
+    }
+
+    int count = length(names);
+    Node *node = makeNode(LETREC_NODE, names, count + length(cdr(args)));
+    node->index = count;
+
+    Scope inner;
+    openScope(&inner, scope);
+    for (Value *name = names; !isNull(name); name = cdr(name)) {
+        declare(&inner, car(name));
+    }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr)) {
+        declareDefines(car(currExpr), &inner);
+    }
+    int i = 0;
+    for (Value *currBinding = bindingsHead; typeOf(currBinding) == CONS_TYPE; currBinding = cdr(currBinding), i++){
+        node->children[i] = analyzeExpr(car(cdr(car(currBinding))), &inner);
+    }
+    for (Value *currExpr = cdr(args); !isNull(currExpr); currExpr = cdr(currExpr), i++) {
+        node->children[i] = analyzeExpr(car(currExpr), &inner);
+    }
+    node->frameSize = inner.count;
+    closeScope(&inner);
+    return node;
 }
 
-Value *evalDefine(Value *args, Frame *frame){
+// Inside a body the name is declared before its value is analyzed, so a
+// procedure defined there can call itself.
+Node *analyzeDefine(Value *args, Scope *scope){
     Value *name = car(args);
-    Value *body = car(cdr(args));
+    Value *valueExpr = car(cdr(args));
 
     //Capstone Work 1
     //special define (with lambda) type
     //e.g. (define (myfunction x y z) (+ x y z))
-    if (name->type == CONS_TYPE){
-        name = car(car(args));
-        body = cons(cdr(car(args)), body);
-        Value *lambda = talloc(sizeof(Value));
-        lambda->type = SYMBOL_TYPE;
-        lambda->s = "lambda";
-        body = cons(lambda, body);
-    } else if (name->type != SYMBOL_TYPE) {
-        printf("Evaluation error: first argument in define must be symbol type \n");
-        texit(0);
+    if (typeOf(name) == CONS_TYPE){
+        valueExpr = cons(lambdaSymbol, cons(cdr(name), cdr(args)));
+        name = car(name);
     }
 
-    addBinding(name, eval(body, frame), frame);
+    if (typeOf(name) != SYMBOL_TYPE) {
+        return analyzeError("Evaluation error: first argument in define must be symbol type ");
+    }
 
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = VOID_TYPE;
-    
-    return returnValue;
+    Node *node = makeNode(DEFINE_NODE, name, 1);
+    if (scope == NULL) {
+        node->depth = -1;
+        node->index = -1;
+    } else {
+        node->depth = 0;
+        node->index = findSlot(scope, name);
+        if (node->index < 0) {
+            node->index = declare(scope, name);
+        }
+    }
+    node->children[0] = analyzeExpr(valueExpr, scope);
+    return node;
 }
 
-Value *evalLambda(Value *args, Frame *frame){
-    Value *newClosure = talloc(sizeof(Value));
-    newClosure->type = CLOSURE_TYPE;
+Node *analyzeLambda(Value *args, Scope *scope){
+    Value *paramNames = car(args);
 
-    if (car(args)->type == CONS_TYPE) {
-        for (Value *curr = car(args); curr->type != NULL_TYPE; curr = cdr(curr)) {
-            if (car(curr)->type != SYMBOL_TYPE) {
-                printf("Evaluation error: first parameter in lambda must be symbol type\n");
-                texit(0);
+    if (typeOf(paramNames) == CONS_TYPE) {
+        for (Value *curr = paramNames; !isNull(curr); curr = cdr(curr)) {
+            if (typeOf(car(curr)) != SYMBOL_TYPE) {
+                return analyzeError("Evaluation error: first parameter in lambda must be symbol type");
             }
-            for (Value *rest = cdr(curr); rest->type != NULL_TYPE; rest = cdr(rest)){
-                if (!strcmp(car(curr)->s, car(rest)->s)){
-                    printf("Evaluation error: duplicate identifier in lambda\n");
-                    texit(0);
+            for (Value *rest = cdr(curr); !isNull(rest); rest = cdr(rest)){
+                if (car(curr) == car(rest)){
+                    return analyzeError("Evaluation error: duplicate identifier in lambda");
                 }
             }
         }
-
-        //paramNames is a flat linkedlist
-        newClosure->closure.paramNames = car(args);
     //Capstone work 2
-    } else if (car(args)->type == SYMBOL_TYPE) {
-        newClosure->closure.paramNames = car(args);
-    } else if (car(args)->type == NULL_TYPE) {
-        newClosure->closure.paramNames = makeNull();
-    } else {
-        printf("Evaluation error: first parameter in lambda must be symbol type or cons type\n");
-        texit(0);
+    } else if (typeOf(paramNames) != SYMBOL_TYPE && typeOf(paramNames) != NULL_TYPE) {
+        return analyzeError("Evaluation error: first parameter in lambda must be symbol type or cons type");
     }
 
-    newClosure->closure.fnBody = car(cdr(args));
-    newClosure->closure.frame = frame;
+    //paramNames is a flat linkedlist, a single rest symbol, or empty
+    Node *node = makeNode(LAMBDA_NODE, paramNames, 1);
+    Scope inner;
+    openScope(&inner, scope);
+    if (typeOf(paramNames) == SYMBOL_TYPE) {
+        declare(&inner, paramNames);
+    } else {
+        for (Value *curr = paramNames; !isNull(curr); curr = cdr(curr)) {
+            declare(&inner, car(curr));
+        }
+    }
+    node->index = inner.count;
+    declareDefines(car(cdr(args)), &inner);
+    node->children[0] = analyzeExpr(car(cdr(args)), &inner);
+    node->frameSize = inner.count;
+    closeScope(&inner);
+    return node;
+}
 
-    return newClosure;
+Node *analyzeSet(Value *args, Scope *scope){
+    Node *node = makeNode(SET_NODE, car(args), 1);
+    resolve(node, car(args), scope);
+    node->children[0] = analyzeExpr(car(cdr(args)), scope);
+    return node;
 }
 
-Value *evalSet(Value *args, Frame *frame){
-    for (Frame *currFrame = frame; currFrame != NULL; currFrame = currFrame->parent) {
-        for (Value *bindingsHead = currFrame->bindings; bindingsHead->type == CONS_TYPE; bindingsHead = cdr(bindingsHead)) {
-            Value *bindingCons = car(bindingsHead);
-            // car(bindingCons) is the key cdr(bindingCons) is the value
-            if (!strcmp(car(bindingCons)->s, car(args)->s)) {
-                bindingCons->c.cdr = eval(car(cdr(args)), frame);
+// Clauses are checked one at a time as the cond runs, so a bad clause only
+// becomes an error when every clause before it has failed.
+Node *analyzeCond(Value *args, Scope *scope){
+    Node *node = makeNode(COND_NODE, NULL, 2 * length(args));
+    int i = 0;
+    for (Value *curr = args; !isNull(curr); curr = cdr(curr), i += 2) {
+        Value *clause = car(curr);
+        if (typeOf(clause) != CONS_TYPE) {
+            node->children[i] = analyzeError("Evaluation error [cond]: argument of cond must be cons type");
+            continue;
+        }
+
+        if (typeOf(car(clause)) == SYMBOL_TYPE) {
+            if (car(clause) != elseSymbol) {
+                node->children[i] = analyzeError("Evaluation error [cond]: unknown symbol in condition");
+                continue;
             }
+        } else {
+            node->children[i] = analyzeExpr(car(clause), scope);
         }
-    }
 
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = VOID_TYPE;
-    
-    return returnValue;
+        if (isNull(cdr(clause))) {
+            node->children[i + 1] = analyzeError("Evaluation error [cond]: clause has no body");
+        } else {
+            node->children[i + 1] = analyzeExpr(car(cdr(clause)), scope);
+        }
+    }
+    return node;
 }
 
-Value *evalBegin(Value *args, Frame *frame){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = VOID_TYPE;
+Node *analyzeCall(Value *first, Value *args, Scope *scope){
+    Node *node = makeNode(CALL_NODE, NULL, 1 + length(args));
+    node->children[0] = analyzeExpr(first, scope);
+    int i = 1;
+    for (Value *currArg = args; !isNull(currArg); currArg = cdr(currArg), i++){
+        node->children[i] = analyzeExpr(car(currArg), scope);
+    }
+    if (node->count == 3 && node->children[0]->kind == VARIABLE_NODE && node->children[0]->depth < 0) {
+        node->index = fastPathFor(first);
+    }
+    return node;
+}
 
-    for (Value *curr = args; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        returnValue = eval(car(curr), frame);
+fastPath fastPathFor(Value *name){
+    if (name == intern("+")) {
+        return FAST_PLUS;
+    } else if (name == intern("-")) {
+        return FAST_MINUS;
+    } else if (name == intern("*")) {
+        return FAST_TIMES;
+    } else if (name == intern("<")) {
+        return FAST_LESS;
+    } else if (name == intern(">")) {
+        return FAST_GREATER;
+    } else if (name == intern("=")) {
+        return FAST_EQUAL;
     }
-    
-    return returnValue;
+    return NO_FAST_PATH;
 }
 
-Value *evalAnd(Value *args, Frame *frame){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = 1;
+// Run an analyzed node to its value. Every step is a safepoint. Nodes never
+// move, but the frame may, so every caller that uses a frame or value after
+// calling execute must have registered it with gcPushRoot().
+//
+// The evaluator is a machine with an explicit stack instead of a recursive C
+// function. To get the value of a subexpression, a node pushes a continuation
+// naming itself and the step it is at, saves its frame on the value stack
+// and has the machine evaluate the subexpression. When a value is ready, the
+// machine pops back to the newest continuation and carries on with that
+// node's next step. A subexpression in tail position (a branch of an if, the
+// last expression of a body, the body of a called procedure) replaces its
+// node without a continuation, so tail calls run in constant space. Non-tail
+// recursion is limited only by the size of the heap, at one continuation and
+// a few value stack entries per level.
+//
+// Frames are made on the frame stack (see tallocStackFrame): closures copy
+// what they capture, so no frame is reachable from the heap, and a frame is
+// dead as soon as the continuation below it resumes or a tail call leaves it.
+Value *execute(Node *node, Frame *frame){
+    Value *value = NULL;
+    int entry = continuationCount;
+    void *entryMark = frameStackMark();
+    int step = 0;
+    if (values == NULL) {
+        initStacks();
+    }
+    gcPushRoot(&frame);
+    gcPushRoot(&value);
 
-    for (Value *curr = args; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        returnValue = eval(car(curr), frame);
-        if (returnValue->type == BOOL_TYPE && returnValue->i == 0) {
-            return returnValue;
-        }
+evaluate:
+    if (gcRequested) {
+        gcCollectRequested();
     }
+    switch (node->kind) {
+        case CONSTANT_NODE:
+            value = node->value;
+            goto resume;
 
-    return returnValue;
-}
+        case VARIABLE_NODE:
+            value = node->depth < 0 ? lookUpGlobal(node) : lookUpLocal(node, frame);
+            goto resume;
 
-Value *evalOr(Value *args, Frame *frame){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = 0;
-    
-    for (Value *curr = args; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        returnValue = eval(car(curr), frame);
-        if (!(returnValue->type == BOOL_TYPE && returnValue->i == 0)) {
-            return returnValue;
-        }
-    }
-    
-    return returnValue;
-}
+        case LAMBDA_NODE:
+            value = makeClosure(node, frame);
+            goto resume;
 
-Value *evalCond(Value *args, Frame *frame){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = VOID_TYPE;
-    
-    for (Value *curr = args; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        if (car(curr)->type != CONS_TYPE) {
-            printf("Evaluation error [cond]: argument of cond must be cons type\n");
+        case ERROR_NODE:
+            printf("%s\n", node->value->s);
             texit(0);
-        }
-        
-        if (car(car(curr))->type == SYMBOL_TYPE) {
-            if (!strcmp(car(car(curr))->s, "else")) {
-                returnValue = eval(car(cdr(car(curr))), frame);
-                break;
-            } else {
-                printf("Evaluation error [cond]: unknown symbol in condition\n");
+            return NULL;
+
+        // With constant or variable operands, the fast path needs no
+        // continuations at all.
+        case CALL_NODE:
+            if (node->index != NO_FAST_PATH && isSimple(node->children[1]) && isSimple(node->children[2])) {
+                Value *procedure = lookUpGlobal(node->children[0]);
+                Value *a = simpleValue(node->children[1], frame);
+                value = fixnumFastPath(node->index, procedure, a, simpleValue(node->children[2], frame));
+                if (value != NULL) {
+                    goto resume;
+                }
+            }
+            pushContinuation(node, 0, frame);
+            node = node->children[0];
+            goto evaluate;
+
+        case IF_NODE:
+        case SET_NODE:
+        case DEFINE_NODE:
+        case LET_NODE:
+            pushContinuation(node, 0, frame);
+            node = node->children[0];
+            goto evaluate;
+
+        case LETSTAR_NODE:
+            frame = newFrame(node->frameSize, frame);
+            step = 0;
+            goto sequence;
+
+        case LETREC_NODE:
+            frame = newFrame(node->frameSize, frame);
+            if (node->index == 0) {
+                step = 0;
+                goto sequence;
+            }
+            pushContinuation(node, 0, frame);
+            node = node->children[0];
+            goto evaluate;
+
+        case BEGIN_NODE:
+        case AND_NODE:
+        case OR_NODE:
+            if (node->count == 0) {
+                value = node->kind == BEGIN_NODE ? VOID_VALUE
+                      : node->kind == AND_NODE ? TRUE_VALUE : FALSE_VALUE;
+                goto resume;
+            }
+            step = 0;
+            goto sequence;
+
+        case COND_NODE:
+            step = 0;
+            goto clause;
+    }
+
+// Run children step onwards of node in frame, keeping the value of the last.
+sequence:
+    if (step == node->count - 1) {
+        node = node->children[step];
+        goto evaluate;
+    }
+    pushContinuation(node, step, frame);
+    node = node->children[step];
+    goto evaluate;
+
+// Try the clause of a cond whose test is child step.
+clause:
+    if (step == node->count) {
+        value = VOID_VALUE;
+        goto resume;
+    }
+    // else clause
+    if (node->children[step] == NULL) {
+        node = node->children[step + 1];
+        goto evaluate;
+    }
+    pushContinuation(node, step, frame);
+    node = node->children[step];
+    goto evaluate;
+
+// Hand value to the newest continuation.
+resume: {
+    if (continuationCount == entry) {
+        frameStackRelease(entryMark);
+        gcPopRoots(2);
+        return value;
+    }
+    Continuation *next = &continuations[continuationCount - 1];
+    frameStackRelease(next->mark);
+    node = next->node;
+    step = next->step;
+    frame = (Frame *)values[next->base];
+
+    switch (node->kind) {
+        case IF_NODE:
+            popContinuation();
+            if (typeOf(value) != BOOL_TYPE){
+                printf("Evaluation error: condition of an if expression must be a boolean\n");
                 texit(0);
             }
-        } else {
-            
-            Value *condResult = eval(car(car(curr)), frame);
-            if (condResult->type == BOOL_TYPE){
-                if (condResult->i == 1){
-                    returnValue = eval(car(cdr(car(curr))), frame);
-                    break;
+            node = node->children[value == TRUE_VALUE ? 1 : 2];
+            goto evaluate;
+
+        // Setting a variable that is bound nowhere does nothing.
+        case SET_NODE:
+            popContinuation();
+            if (node->depth < 0) {
+                Value *bindingCons = globalBinding(node);
+                if (bindingCons != NULL) {
+                    bindingCons->c.cdr = value;
+                    gcWriteBarrier(bindingCons);
+                }
+            } else {
+                Frame *scope = frame;
+                for (int depth = node->depth; depth > 0; depth--) {
+                    scope = scope->parent;
                 }
+                setLocal(scope, node->index, value);
+            }
+            value = VOID_VALUE;
+            goto resume;
+
+        case DEFINE_NODE:
+            popContinuation();
+            if (node->depth < 0) {
+                addBinding(node->value, value, globalFrame);
             } else {
+                setLocal(frame, node->index, value);
+            }
+            value = VOID_VALUE;
+            goto resume;
+
+        // The initializers run in the enclosing frame and are collected on
+        // the value stack above it.
+        case LET_NODE:
+            if (step >= node->index) {
+                popContinuation();
+                step++;
+                goto sequence;
+            }
+            pushValue(value);
+            if (step + 1 < node->index) {
+                next->step++;
+                node = node->children[step + 1];
+                goto evaluate;
+            }
+            frame = newFrame(node->frameSize, frame);
+            memcpy(frame->slots, &values[next->base + 1], sizeof(Value *) * node->index);
+            popContinuation();
+            step = node->index;
+            goto sequence;
+
+        // Every initializer runs in the new frame before any name is bound,
+        // so an initializer that uses one of the names is an error.
+        case LETREC_NODE:
+            if (step >= node->index) {
+                popContinuation();
+                step++;
+                goto sequence;
+            }
+            pushValue(value);
+            if (step + 1 < node->index) {
+                next->step++;
+                node = node->children[step + 1];
+                goto evaluate;
+            }
+            // a closure made by an initializer may have boxed a slot already
+            for (int i = 0; i < node->index; i++) {
+                setLocal(frame, i, values[next->base + 1 + i]);
+            }
+            popContinuation();
+            step = node->index;
+            goto sequence;
+
+        case LETSTAR_NODE:
+        case BEGIN_NODE:
+            popContinuation();
+            step++;
+            goto sequence;
+
+        case AND_NODE:
+            popContinuation();
+            if (value == FALSE_VALUE) {
+                goto resume;
+            }
+            step++;
+            goto sequence;
+
+        case OR_NODE:
+            popContinuation();
+            if (value != FALSE_VALUE) {
+                goto resume;
+            }
+            step++;
+            goto sequence;
+
+        case COND_NODE:
+            popContinuation();
+            if (typeOf(value) != BOOL_TYPE) {
                 printf("Evaluation error [cond]: incorrect type in condition\n");
                 texit(0);
             }
+            if (value == TRUE_VALUE) {
+                node = node->children[step + 1];
+                goto evaluate;
+            }
+            step += 2;
+            goto clause;
+
+        // The operator and operands are collected on the value stack above
+        // the frame; the call itself replaces the CALL_NODE.
+        case CALL_NODE: {
+            pushValue(value);
+            if (step + 1 < node->count) {
+                next->step++;
+                node = node->children[step + 1];
+                goto evaluate;
+            }
+
+            // the operands stay where they are on the stack and are passed
+            // from there
+            Value *procedure = values[next->base + 1];
+            Value **arguments = &values[next->base + 2];
+            int argc = node->count - 1;
+
+            if (node->index != NO_FAST_PATH) {
+                value = fixnumFastPath(node->index, procedure, arguments[0], arguments[1]);
+                if (value != NULL) {
+                    popContinuation();
+                    goto resume;
+                }
+            }
+
+            // The call replaces everything the continuation below made,
+            // the caller's frames included if this is a tail call. The
+            // operands stay intact on the value stack until they are copied.
+            if (typeOf(procedure) == CLOSURE_TYPE) {
+                popContinuation();
+                frameStackRelease(continuationCount == entry
+                                  ? entryMark : continuations[continuationCount - 1].mark);
+                if (jitReady(procedure->closure.code)) {
+                    value = jitApply(procedure, argc, arguments);
+                    goto resume;
+                }
+                frame = callFrame(procedure, argc, arguments);
+                node = procedure->closure.code->children[0];
+                goto evaluate;
+            } else if (typeOf(procedure) == PRIMITIVE_TYPE){
+                value = (procedure->primFn)(argc, arguments);
+                popContinuation();
+                goto resume;
+            } else {
+                printf("Evaluation error: undefined procedure\n");
+                texit(0);
+            }
         }
+
+        default:
+            break;
     }
+    return NULL;
+}
+}
 
-    return returnValue;
+void initStacks(){
+    int capacity = 1024;
+    values = tallocTenured(sizeof(Value *) * capacity, RAW_KIND);
+    valuesTop = values;
+    valuesLimit = values + capacity;
+    gcAddGlobalRoot(&values);
+    gcAddRootStack(&values, &valuesTop);
+
+    continuationCapacity = capacity;
+    continuationCount = 0;
+    continuations = tallocTenured(sizeof(Continuation) * continuationCapacity, RAW_KIND);
+    gcAddGlobalRoot(&continuations);
 }
 
-Frame *createLinkedFrames(Value *bindingsHead, Frame *parentFrame){
-    Frame *preFrame = parentFrame;
-    for (Value *currBinding = bindingsHead; currBinding->type == CONS_TYPE; currBinding = cdr(currBinding)){
-        if (car(currBinding)->type != CONS_TYPE) {
-            printf("Evaluation error: bad format in let\n");
-            texit(0);
-        }
-        if (length(car(currBinding)) != 2){
-            printf("Evaluation error: invalid number of keys and bindings\n");
-            texit(0);
-        }
+// Allocation never collects, so the old block may be dropped right away.
+void growValues(){
+    int used = (int)(valuesTop - values);
+    int capacity = (int)(valuesLimit - values) * 2;
+    Value **bigger = tallocTenured(sizeof(Value *) * capacity, RAW_KIND);
+    memcpy(bigger, values, sizeof(Value *) * used);
+    values = bigger;
+    valuesTop = values + used;
+    valuesLimit = values + capacity;
+}
 
-        Frame *newFrame = talloc(sizeof(Frame));
-        newFrame->bindings = makeNull();
-        newFrame->parent = NULL;
+void growContinuations(){
+    continuationCapacity *= 2;
+    Continuation *bigger = tallocTenured(sizeof(Continuation) * continuationCapacity, RAW_KIND);
+    memcpy(bigger, continuations, sizeof(Continuation) * continuationCount);
+    continuations = bigger;
+}
 
-        Value *newBinding = talloc(sizeof(Value));
-        newBinding->type = CONS_TYPE;
-        
-        Value *key = car(car(currBinding));
-        Value *value = car(cdr(car(currBinding)));
+int isSimple(Node *node){
+    return node->kind == CONSTANT_NODE || node->kind == VARIABLE_NODE;
+}
 
-        if (key->type != SYMBOL_TYPE){
-            printf("Evaluation error: left side of a let pair doesn't have a variable.\n");
-            texit(0);
-        } else if (lookUpSymbol(key, newFrame) == NULL){
-            newBinding->c.car = key;
-            newBinding->c.cdr = eval(value, preFrame);
-        } else {
-            printf("Evaluation error: duplicate variable in let\n");
-            texit(0);
-        }
-        
-        newFrame->bindings = cons(newBinding, newFrame->bindings);
-        newFrame->parent = preFrame;
-        preFrame = newFrame;
+Value *simpleValue(Node *node, Frame *frame){
+    if (node->kind == CONSTANT_NODE) {
+        return node->value;
     }
-    
-    return preFrame;
+    return node->depth < 0 ? lookUpGlobal(node) : lookUpLocal(node, frame);
 }
 
-Frame *createFrame(Value *bindingsHead, Frame *parentFrame){
-    Frame *newFrame = talloc(sizeof(Frame));
-    newFrame->bindings = makeNull();
-    newFrame->parent = NULL;
-    
-    for (Value *currBinding = bindingsHead; currBinding->type == CONS_TYPE; currBinding = cdr(currBinding)){
-        if (car(currBinding)->type != CONS_TYPE) {
-            printf("Evaluation error: bad format in let\n");
-            texit(0);
-        }
-        if (length(car(currBinding)) != 2){
-            printf("Evaluation error: invalid number of keys and bindings\n");
-            texit(0);
-        }
+Frame *newFrame(int count, Frame *parent){
+    Frame *frame = tallocStackFrame(count);
+    frame->parent = parent;
+    return frame;
+}
 
-        Value *newBinding = talloc(sizeof(Value));
-        newBinding->type = CONS_TYPE;
-        
-        Value *key = car(car(currBinding));
-        Value *value = car(cdr(car(currBinding)));
+Value *lookUpLocal(Node *node, Frame *frame){
+    for (int depth = node->depth; depth > 0; depth--) {
+        frame = frame->parent;
+    }
+    Value *result = frame->slots[node->index];
+    if (node->boxed && isBox(result)) {
+        result = result->c.car;
+    }
+    // declared, but its let, letrec or define has not bound it yet
+    if (result == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    return result;
+}
 
-        if (key->type != SYMBOL_TYPE){
-            printf("Evaluation error: left side of a let pair doesn't have a variable.\n");
-            texit(0);
-        } else if (lookUpSymbol(key, newFrame) == NULL){
-            newBinding->c.car = key;
-            newBinding->c.cdr = eval(value, parentFrame);
-        } else {
-            printf("Evaluation error: duplicate variable in let\n");
-            texit(0);
+// A slot holds a box once a closure has captured its variable; the variable
+// is then the box's car.
+void setLocal(Frame *frame, int index, Value *value){
+    Value *slot = frame->slots[index];
+    if (isBox(slot)) {
+        slot->c.car = value;
+        gcWriteBarrier(slot);
+    } else {
+        frame->slots[index] = value;
+        gcWriteBarrier(frame);
+    }
+}
+
+// The captured frame has no parent: the body reaches everything it uses from
+// outside through it, or through the global frame. An assigned variable is
+// boxed in its frame the first time a closure captures it, so the frame and
+// every closure share it from then on.
+Value *makeClosure(Node *lambda, Frame *frame){
+    Frame *captured = NULL;
+    if (lambda->count > 1) {
+        captured = tallocFrame(lambda->count - 1);
+        for (int i = 1; i < lambda->count; i++) {
+            Node *variable = lambda->children[i];
+            Frame *scope = frame;
+            for (int depth = variable->depth; depth > 0; depth--) {
+                scope = scope->parent;
+            }
+            Value *value = scope->slots[variable->index];
+            if (variable->boxed && !isBox(value)) {
+                Value *box = tallocValue();
+                box->type = BOX_TYPE;
+                box->c.car = value;
+                scope->slots[variable->index] = box;
+                gcWriteBarrier(scope);
+                value = box;
+            }
+            captured->slots[i - 1] = value;
         }
-        
-        newFrame->bindings = cons(newBinding, newFrame->bindings);
     }
-    
-    newFrame->parent = parentFrame;
-    return newFrame;
+
+    Value *closure = tallocValue();
+    closure->type = CLOSURE_TYPE;
+    closure->closure.code = lambda;
+    closure->closure.frame = captured;
+    return closure;
+}
+
+// A let runs its initializers in the enclosing frame; everything else under
+// a let, let*, letrec or lambda runs in the new frame, except the variables
+// a lambda captures, which are read where the lambda is run.
+int opensFrame(Node *node, int child){
+    switch (node->kind) {
+        case LET_NODE:
+            return child >= node->index;
+
+        case LETSTAR_NODE:
+        case LETREC_NODE:
+            return 1;
+
+        case LAMBDA_NODE:
+            return child == 0;
+
+        default:
+            return 0;
+    }
 }
 
-// function and args should already be evaluated
-Value *apply(Value *function, Value *args){
-    if (function->type != CLOSURE_TYPE) {
+// Bindings are never removed, and define and set! change the cell in place,
+// so a cell once found stays right for as long as the program runs.
+Value *globalBinding(Node *node){
+    if (node->binding == NULL) {
+        node->binding = findTableBinding(node->value, globalFrame);
+    }
+    return node->binding;
+}
+
+Value *lookUpGlobal(Node *node){
+    Value *bindingCons = globalBinding(node);
+    // If symbol's value cannot be found
+    if (bindingCons == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    return cdr(bindingCons);
+}
+
+// function and args should already be evaluated; the caller runs the body
+// in the returned frame
+Frame *callFrame(Value *function, int argc, Value **argv){
+    if (typeOf(function) != CLOSURE_TYPE) {
         printf("Evaluation error: function must be CLOSURE_TYPE\n");
         texit(0);
     }
 
-    Frame *newFrame = talloc(sizeof(Frame));
-    newFrame->bindings = makeNull();
+    Node *lambda = function->closure.code;
+    Frame *newFrame = tallocStackFrame(lambda->frameSize);
     newFrame->parent = function->closure.frame;
 
     // Capstone work 2
-    if (function->closure.paramNames->type == SYMBOL_TYPE) {
-        addBinding((function->closure.paramNames), args, newFrame);
-        return eval(function->closure.fnBody, newFrame);
+    if (typeOf(lambda->value) == SYMBOL_TYPE) {
+        Value *args = makeNull();
+        for (int i = argc - 1; i >= 0; i--) {
+            args = cons(argv[i], args);
+        }
+        newFrame->slots[0] = args;
+        return newFrame;
     }
 
-    if (length(function->closure.paramNames) != length(args)) {
+    if (lambda->index != argc) {
         printf("Evaluation error: incurrent number of arguments of procedure\n");
         texit(0);
     }
 
-    for (Value *key = function->closure.paramNames; key->type != NULL_TYPE; key = cdr(key), args = cdr(args)){
-        addBinding(car(key), car(args), newFrame);
-    }
+    memcpy(newFrame->slots, argv, sizeof(Value *) * argc);
+    return newFrame;
+}
 
-    return eval(function->closure.fnBody, newFrame);
+// The frames the call makes are released when it returns.
+Value *applyClosure(Value *closure, int argc, Value **argv){
+    void *mark = frameStackMark();
+    Value *result = execute(closure->closure.code->children[0], callFrame(closure, argc, argv));
+    frameStackRelease(mark);
+    return result;
 }
 
+// Only the global frame binds names at run time. Redefining a global updates
+// its binding in place.
 void addBinding(Value *key, Value *value, Frame *frame){
-    Value *newBinding = talloc(sizeof(Value));
+    Value *bindingCons = findTableBinding(key, frame);
+    if (bindingCons != NULL) {
+        bindingCons->c.cdr = value;
+        gcWriteBarrier(bindingCons);
+        return;
+    }
+
+    // Nodes cache binding cells, so the cells go straight to the old
+    // generation and never move.
+    Value *newBinding = tallocTenured(sizeof(Value), VALUE_KIND);
     newBinding->type = CONS_TYPE;
     newBinding->c.car = key;
     newBinding->c.cdr = value;
-    frame->bindings = cons(newBinding, frame->bindings);
+    insertTableBinding(newBinding, frame);
 }
 
-void bindPrimitiveFn(char *name, Value *(*function)(struct Value *), Frame *frame) {
-    Value *newName = talloc(sizeof(Value));
-    newName->type = SYMBOL_TYPE;
-    newName->s = name;
+// Symbols are interned and never move, so their address is the hash key.
+int tableSlot(Value *key, int mask){
+    return (int)(((uintptr_t)key >> 3) * 2654435761u) & mask;
+}
+
+// The table is probed linearly and always kept at most half full.
+Value *findTableBinding(Value *key, Frame *frame){
+    int mask = frame->tableCapacity - 1;
+    int slot = tableSlot(key, mask);
+    while (frame->table[slot] != NULL) {
+        if (car(frame->table[slot]) == key) {
+            return frame->table[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+void insertTableBinding(Value *binding, Frame *frame){
+    if ((frame->tableCount + 1) * 2 > frame->tableCapacity) {
+        Value **oldTable = frame->table;
+        int oldCapacity = frame->tableCapacity;
+        frame->tableCapacity = oldCapacity * 2;
+        frame->table = (Value **)tallocArray(frame->tableCapacity);
+        frame->tableCount = 0;
+        gcWriteBarrier(frame);
+        for (int i = 0; i < oldCapacity; i++) {
+            if (oldTable[i] != NULL) {
+                insertTableBinding(oldTable[i], frame);
+            }
+        }
+    }
+
+    int mask = frame->tableCapacity - 1;
+    int slot = tableSlot(car(binding), mask);
+    while (frame->table[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    frame->table[slot] = binding;
+    frame->tableCount++;
+    gcWriteBarrier(frame->table);
+}
 
-    Value *newFunction = talloc(sizeof(Value));
+void bindPrimitiveFn(char *name, Value *(*function)(int, Value **), Frame *frame) {
+    Value *newFunction = tallocValue();
     newFunction->type = PRIMITIVE_TYPE;
     newFunction->primFn = function;
 
-    addBinding(newName, newFunction, frame);
-}
-
-Value *primitivePlus(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    if (args->type == NULL_TYPE){
-        returnValue->type = INT_TYPE;
-        returnValue->i = 0;
-    } else if (car(args)->type == INT_TYPE || car(args)->type == DOUBLE_TYPE) {
-        int i = 0;
-        double d = 0.0;
-        for (Value *argument = args; argument->type != NULL_TYPE; argument = cdr(argument)) {
-            if (car(argument)->type == DOUBLE_TYPE){
-                d += car(argument)->d;
-            } else if (car(argument)->type == INT_TYPE) {
-                i += car(argument)->i;
-            } else {
-                printf("Evaluation error: incurrent type for plus argument\n");
-                texit(0);
+    addBinding(intern(name), newFunction, frame);
+}
+
+// +, - and * work out fixnums exactly in a long. When a step would overflow,
+// the long so far goes into the double and starts again from the operand,
+// so the result is a double only if an operand is one or it does not fit.
+Value *primitivePlus(int argc, Value **argv){
+    long i = 0;
+    double d = 0.0;
+    int overflow = 0;
+    for (int arg = 0; arg < argc; arg++) {
+        if (typeOf(argv[arg]) == DOUBLE_TYPE){
+            d += argv[arg]->d;
+        } else if (isFixnum(argv[arg])) {
+            long sum;
+            if (__builtin_add_overflow(i, fixnumValue(argv[arg]), &sum)) {
+                d += i;
+                sum = fixnumValue(argv[arg]);
+                overflow = 1;
             }
-        }
-        if (d != 0.0){
-            returnValue->type = DOUBLE_TYPE;
-            returnValue->d = d + i;
+            i = sum;
         } else {
-            returnValue->type = INT_TYPE;
-            returnValue->i = i;
+            printf("Evaluation error: incurrent type for plus argument\n");
+            texit(0);
         }
     }
-    return returnValue;
+    if (d != 0.0 || overflow || i < FIXNUM_MIN || i > FIXNUM_MAX){
+        return makeDouble(d + i);
+    }
+    return makeFixnum(i);
 }
 
-Value *primitiveMinus(Value *args){
-    if (args->type == NULL_TYPE){
+Value *primitiveMinus(int argc, Value **argv){
+    if (argc == 0){
         printf("Evaluation error: incorrect number of minus argument\n");
         texit(0);
     }
 
-    Value *returnValue = talloc(sizeof(Value));
-
-    double subtractValue = 0.0;
+    long i = 0;
+    double d = 0.0;
     int hasDouble = 0;
-    Value *remainValues = args;
-
-    if (length(args) > 1) {
-        if (car(args)->type == INT_TYPE) {
-            subtractValue = car(args)->i;
-            remainValues = cdr(args);
-        } else if (car(args)->type == DOUBLE_TYPE) {
-            subtractValue = car(args)->d;
-            remainValues = cdr(args);
+    int first = 0;
+
+    if (argc > 1) {
+        if (isFixnum(argv[0])) {
+            i = fixnumValue(argv[0]);
+            first = 1;
+        } else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+            d = argv[0]->d;
+            first = 1;
             hasDouble = 1;
         } else {
             printf("Evaluation error: incorrect type for minus argument\n");
@@ -675,12 +1468,18 @@ Value *primitiveMinus(Value *args){
         }
     }
     
-    for (Value *argument = remainValues; argument->type != NULL_TYPE; argument = cdr(argument)) {
-        if (car(argument)->type == DOUBLE_TYPE){
-            subtractValue -= car(argument)->d;
+    for (int arg = first; arg < argc; arg++) {
+        if (typeOf(argv[arg]) == DOUBLE_TYPE){
+            d -= argv[arg]->d;
             hasDouble = 1;
-        } else if (car(argument)->type == INT_TYPE) {
-            subtractValue -= car(argument)->i;
+        } else if (isFixnum(argv[arg])) {
+            long difference;
+            if (__builtin_sub_overflow(i, fixnumValue(argv[arg]), &difference)) {
+                d += i;
+                difference = -fixnumValue(argv[arg]);
+                hasDouble = 1;
+            }
+            i = difference;
         } else {
             printf("Evaluation error: incorrect type for plus argument\n");
             texit(0);
@@ -688,250 +1487,177 @@ Value *primitiveMinus(Value *args){
     }
 
     
-    if (hasDouble){
-        returnValue->type = DOUBLE_TYPE;
-        returnValue->d = subtractValue;
-    } else {
-        returnValue->type = INT_TYPE;
-        returnValue->i = subtractValue;
+    if (hasDouble || i < FIXNUM_MIN || i > FIXNUM_MAX){
+        return makeDouble(d + i);
     }
-    
-    return returnValue;
+    return makeFixnum(i);
 }
 
-Value *primitiveNull(Value *args){
-    if (length(args) != 1){
+Value *primitiveNull(int argc, Value **argv){
+    if (argc != 1){
         printf("Evaluation error: incurrent number for null? argument\n");
         texit(0);
     }
 
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = isNull(car(args));
-
-    return returnValue;
+    return makeBool(isNull(argv[0]));
 }
 
-Value *primitiveCar(Value *args){
-    if (length(args) != 1){
+Value *primitiveCar(int argc, Value **argv){
+    if (argc != 1){
         printf("Evaluation error: incurrent number for car argument\n");
         texit(0);
-    } else if (car(args)->type != CONS_TYPE) {
+    } else if (typeOf(argv[0]) != CONS_TYPE) {
         printf("Evaluation error: car argument must be a CONS_TYPE\n");
         texit(0);
     }
 
-    return car(car(args));
+    return car(argv[0]);
 }
 
-Value *primitiveCdr(Value* args) {
-    if (length(args) != 1){
+Value *primitiveCdr(int argc, Value **argv) {
+    if (argc != 1){
         printf("Evaluation error [cdr]: incurrent number for cdr argument\n");
         texit(0);
-    } else if (car(args)->type != CONS_TYPE) {
+    } else if (typeOf(argv[0]) != CONS_TYPE) {
         printf("Evaluation error: cdr argument must be a CONS_TYPE\n");
         texit(0);
     }
 
-    return cdr(car(args));
+    return cdr(argv[0]);
 }
 
-Value *primitiveCons(Value *args){
-    if (length(args) != 2) {
+Value *primitiveCons(int argc, Value **argv){
+    if (argc != 2) {
         printf("Evaluation error [cons]: incurrent number for cons argument\n");
         texit(0);
     }
 
-    Value *newConscell = talloc(sizeof(Value));
-    newConscell->type = CONS_TYPE;
-    newConscell->c.car = car(args);
-    newConscell->c.cdr = car(cdr(args));
-
-    return newConscell;
+    return cons(argv[0], argv[1]);
 }
 
-Value *primitiveBigger(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = 1;
-
-    if (length(args) < 2) {
-        return returnValue;
-    }
-
-    double preNumber;
-    double thisNumber;
-    
-    if (car(args)->type == INT_TYPE){
-        preNumber = car(args)->i;
-    } else if (car(args)->type == DOUBLE_TYPE){
-        preNumber = car(args)->d;
-    } else{
-        printf("Evaluation error [>]: incorrect type for argument\n");
-        texit(0);
+// Shared by >, < and =: true when compare holds for the order of every
+// adjacent pair.
+Value *compareNumbers(int argc, Value **argv, char *name, int (*compare)(int)){
+    if (argc < 2) {
+        return TRUE_VALUE;
     }
 
-    for (Value *argument = cdr(args); argument->type != NULL_TYPE; argument = cdr(argument)) {
-        if (car(argument)->type == INT_TYPE){
-            thisNumber = car(argument)->i;
-        } else if (car(argument)->type == DOUBLE_TYPE){
-            thisNumber = car(argument)->d;
-        } else {
-            printf("Evaluation error [>]: incorrect type for argument\n");
+    for (int arg = 0; arg < argc; arg++) {
+        if (!isFixnum(argv[arg]) && typeOf(argv[arg]) != DOUBLE_TYPE){
+            printf("Evaluation error [%s]: incorrect type for argument\n", name);
             texit(0);
         }
 
-        if (thisNumber >= preNumber){
-            returnValue->i = 0;
-            break;
+        if (arg > 0 && !compare(numberOrder(argv[arg - 1], argv[arg]))){
+            return FALSE_VALUE;
         }
-
-        preNumber = thisNumber;
     }
 
-    return returnValue;
+    return TRUE_VALUE;
 }
 
-Value *primitiveSmaller(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = 1;
-
-    if (length(args) < 2) {
-        return returnValue;
+// Two fixnums are compared exactly, since a double only holds integers up to
+// 2^53 exactly; a pair with a double in it is compared as doubles.
+int numberOrder(Value *a, Value *b){
+    if (isFixnum(a) && isFixnum(b)) {
+        long x = fixnumValue(a);
+        long y = fixnumValue(b);
+        return (x > y) - (x < y);
     }
 
-    double preNumber;
-    double thisNumber;
-    
-    if (car(args)->type == INT_TYPE){
-        preNumber = car(args)->i;
-    } else if (car(args)->type == DOUBLE_TYPE){
-        preNumber = car(args)->d;
-    } else{
-        printf("Evaluation error [<]: incorrect type for argument\n");
-        texit(0);
-    }
-
-    for (Value *argument = cdr(args); argument->type != NULL_TYPE; argument = cdr(argument)) {
-        if (car(argument)->type == INT_TYPE){
-            thisNumber = car(argument)->i;
-        } else if (car(argument)->type == DOUBLE_TYPE){
-            thisNumber = car(argument)->d;
-        } else {
-            printf("Evaluation error [<]: incorrect type for argument\n");
-            texit(0);
-        }
-
-        if (thisNumber <= preNumber){
-            returnValue->i = 0;
-            break;
-        }
-
-        preNumber = thisNumber;
+    double x = isFixnum(a) ? fixnumValue(a) : a->d;
+    double y = isFixnum(b) ? fixnumValue(b) : b->d;
+    if (x < y) {
+        return -1;
+    } else if (x > y) {
+        return 1;
+    } else if (x == y) {
+        return 0;
     }
-
-    return returnValue;
+    return 2;
 }
 
-Value *primitiveEqual(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = BOOL_TYPE;
-    returnValue->i = 1;
-
-    if (length(args) < 2) {
-        return returnValue;
-    }
+int isBigger(int order){
+    return order == 1;
+}
 
-    double preNumber;
-    double thisNumber;
-    
-    if (car(args)->type == INT_TYPE){
-        preNumber = car(args)->i;
-    } else if (car(args)->type == DOUBLE_TYPE){
-        preNumber = car(args)->d;
-    } else{
-        printf("Evaluation error [=]: incorrect type for argument\n");
-        texit(0);
-    }
+int isSmaller(int order){
+    return order == -1;
+}
 
-    for (Value *argument = cdr(args); argument->type != NULL_TYPE; argument = cdr(argument)) {
-        if (car(argument)->type == INT_TYPE){
-            thisNumber = car(argument)->i;
-        } else if (car(argument)->type == DOUBLE_TYPE){
-            thisNumber = car(argument)->d;
-        } else {
-            printf("Evaluation error [=]: incorrect type for argument\n");
-            texit(0);
-        }
+int isEqual(int order){
+    return order == 0;
+}
 
-        if (thisNumber != preNumber){
-            returnValue->i = 0;
-            break;
-        }
+Value *primitiveBigger(int argc, Value **argv){
+    return compareNumbers(argc, argv, ">", isBigger);
+}
 
-        preNumber = thisNumber;
-    }
+Value *primitiveSmaller(int argc, Value **argv){
+    return compareNumbers(argc, argv, "<", isSmaller);
+}
 
-    return returnValue;
+Value *primitiveEqual(int argc, Value **argv){
+    return compareNumbers(argc, argv, "=", isEqual);
 }
 
-Value *primitiveMultiple(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    if (length(args) < 2){
+Value *primitiveMultiple(int argc, Value **argv){
+    if (argc < 2){
         printf("Evaluation error [*]: incorrect number of arguments\n");
         texit(0);
-    } else if (car(args)->type == INT_TYPE || car(args)->type == DOUBLE_TYPE) {
-        int hasDouble = 0;
-        double d = 1.0;
+    }
+
+    long i = 1;
+    double d = 1.0;
+    int hasDouble = 0;
 
-        for (Value *argument = args; argument->type != NULL_TYPE; argument = cdr(argument)) {
-            if (car(argument)->type == DOUBLE_TYPE){
-                d *= car(argument)->d;
+    for (int arg = 0; arg < argc; arg++) {
+        if (typeOf(argv[arg]) == DOUBLE_TYPE){
+            d *= argv[arg]->d;
+            hasDouble = 1;
+        } else if (isFixnum(argv[arg])) {
+            long product;
+            if (__builtin_mul_overflow(i, fixnumValue(argv[arg]), &product)) {
+                d *= i;
+                product = fixnumValue(argv[arg]);
                 hasDouble = 1;
-            } else if (car(argument)->type == INT_TYPE) {
-                d *= car(argument)->i;
-            } else {
-                printf("Evaluation error: incurrent type for plus argument\n");
-                texit(0);
             }
-        }
-        
-        if (hasDouble){
-            returnValue->type = DOUBLE_TYPE;
-            returnValue->d = d;
+            i = product;
         } else {
-            returnValue->type = INT_TYPE;
-            returnValue->i = d;
+            printf("Evaluation error: incurrent type for plus argument\n");
+            texit(0);
         }
     }
-    return returnValue;
+
+    if (hasDouble || i < FIXNUM_MIN || i > FIXNUM_MAX){
+        return makeDouble(d * i);
+    }
+    return makeFixnum(i);
 }
 
-Value *primitiveDivide(Value *args){
-    Value *returnValue = talloc(sizeof(Value));
-    if (length(args) != 2){
+Value *primitiveDivide(int argc, Value **argv){
+    if (argc != 2){
         printf("Evaluation error [/]: incorrect number of arguments\n");
         texit(0);
     }
 
     double divident, divisor;
     int hasInt = 0;
-    if (car(args)->type == INT_TYPE) {
-        divident = car(args)->i;
+    if (isFixnum(argv[0])) {
+        divident = fixnumValue(argv[0]);
         hasInt++;
-    } else if (car(args)->type == DOUBLE_TYPE) {
-        divident = car(args)->d;
+    } else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+        divident = argv[0]->d;
     } else {
         printf("Evaluation error [/]: incorrect type for divident\n");
         texit(0);
     }
     
-    if (car(cdr(args))->type == INT_TYPE) {
-        divisor = car(cdr(args))->i;
+    if (isFixnum(argv[1])) {
+        divisor = fixnumValue(argv[1]);
         hasInt++;
-    } else if (car(cdr(args))->type == DOUBLE_TYPE) {
-        divisor = car(cdr(args))->d;
+    } else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+        divisor = argv[1]->d;
     } else {
         printf("Evaluation error [/]: incorrect type for divisor\n");
         texit(0);
@@ -942,37 +1668,151 @@ Value *primitiveDivide(Value *args){
         texit(0);
     }
 
-    if (hasInt == 2 && ((int)divident % (int)divisor) == 0) {
-        returnValue->type = INT_TYPE;
-        returnValue->i = divident / divisor;
-    } else {
-        returnValue->type = DOUBLE_TYPE;
-        returnValue->d = divident / divisor;
+    // the one exact quotient that does not fit is FIXNUM_MIN / -1
+    if (hasInt == 2 && fixnumValue(argv[0]) % fixnumValue(argv[1]) == 0) {
+        long quotient = fixnumValue(argv[0]) / fixnumValue(argv[1]);
+        if (quotient >= FIXNUM_MIN && quotient <= FIXNUM_MAX) {
+            return makeFixnum(quotient);
+        }
     }
-    
-    return returnValue;
+    return makeDouble(divident / divisor);
 }
 
-Value *primitiveModulo(Value *args){
-    if (length(args) != 2){
+Value *primitiveModulo(int argc, Value **argv){
+    if (argc != 2){
         printf("Evaluation error [modulo]: incorrect number of arguments\n");
         texit(0);
-    } else if (car(args)->type != INT_TYPE || car(cdr(args))->type != INT_TYPE) {
+    } else if (!isFixnum(argv[0]) || !isFixnum(argv[1])) {
         printf("Evaluation error [modulo]: incorrect type for arguments\n");
         texit(0);
     }
     
-    Value *returnValue = talloc(sizeof(Value));
-    returnValue->type = INT_TYPE;
-    returnValue->i = car(args)->i % car(cdr(args))->i;
+    return makeFixnum(fixnumValue(argv[0]) % fixnumValue(argv[1]));
+}
+
+// The generic primitives check every operand's type first; here both operands
+// are fixnums, so the result is worked out directly as long as it fits.
+Value *fixnumFastPath(fastPath path, Value *procedure, Value *a, Value *b){
+    if (!isFixnum(a) || !isFixnum(b) || typeOf(procedure) != PRIMITIVE_TYPE) {
+        return NULL;
+    }
+
+    long x = fixnumValue(a);
+    long y = fixnumValue(b);
+    long result;
+    switch (path) {
+        case FAST_PLUS:
+            if (procedure->primFn != primitivePlus) {
+                return NULL;
+            }
+            result = x + y;
+            break;
+
+        case FAST_MINUS:
+            if (procedure->primFn != primitiveMinus) {
+                return NULL;
+            }
+            result = x - y;
+            break;
+
+        case FAST_TIMES:
+            if (procedure->primFn != primitiveMultiple || __builtin_mul_overflow(x, y, &result)) {
+                return NULL;
+            }
+            break;
+
+        case FAST_LESS:
+            return procedure->primFn == primitiveSmaller ? makeBool(x < y) : NULL;
+
+        case FAST_GREATER:
+            return procedure->primFn == primitiveBigger ? makeBool(x > y) : NULL;
+
+        case FAST_EQUAL:
+            return procedure->primFn == primitiveEqual ? makeBool(x == y) : NULL;
 
-    return returnValue;   
+        default:
+            return NULL;
+    }
+
+    if (result < FIXNUM_MIN || result > FIXNUM_MAX) {
+        return NULL;
+    }
+    return makeFixnum(result);
+}
+
+Value *(*fastPathPrimitive(fastPath path))(int argc, Value **argv){
+    switch (path) {
+        case FAST_PLUS:
+            return primitivePlus;
+
+        case FAST_MINUS:
+            return primitiveMinus;
+
+        case FAST_TIMES:
+            return primitiveMultiple;
+
+        case FAST_LESS:
+            return primitiveSmaller;
+
+        case FAST_GREATER:
+            return primitiveBigger;
+
+        case FAST_EQUAL:
+            return primitiveEqual;
+
+        default:
+            return NULL;
+    }
+}
+
+// Every argument must be a number for the arithmetic and comparison
+// primitives to succeed.
+int allNumbers(int argc, Value **argv){
+    for (int arg = 0; arg < argc; arg++) {
+        if (!isFixnum(argv[arg]) && typeOf(argv[arg]) != DOUBLE_TYPE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The checks mirror the ones each primitive makes before it reports an
+// error. cons is never folded: every call must make a new pair.
+Value *foldPrimitive(Value *procedure, int argc, Value **argv){
+    Value *(*function)(int, Value **) = procedure->primFn;
+    int canFold = 0;
+    if (function == primitivePlus || function == primitiveBigger
+        || function == primitiveSmaller || function == primitiveEqual) {
+        canFold = allNumbers(argc, argv);
+    } else if (function == primitiveMinus) {
+        canFold = argc >= 1 && allNumbers(argc, argv);
+    } else if (function == primitiveMultiple) {
+        canFold = argc >= 2 && allNumbers(argc, argv);
+    } else if (function == primitiveDivide) {
+        canFold = argc == 2 && allNumbers(argc, argv)
+                  && (isFixnum(argv[1]) ? fixnumValue(argv[1]) != 0 : argv[1]->d != 0);
+    } else if (function == primitiveModulo) {
+        canFold = argc == 2 && isFixnum(argv[0]) && isFixnum(argv[1]) && fixnumValue(argv[1]) != 0;
+    } else if (function == primitiveNull) {
+        canFold = argc == 1;
+    } else if (function == primitiveCar || function == primitiveCdr) {
+        canFold = argc == 1 && typeOf(argv[0]) == CONS_TYPE;
+    }
+    return canFold ? function(argc, argv) : NULL;
+}
+
+// Box a double; unlike integers, doubles are not immediates.
+Value *makeDouble(double d){
+    Value *returnValue = tallocValue();
+    returnValue->type = DOUBLE_TYPE;
+    returnValue->d = d;
+    return returnValue;
 }
 
 void printEvalResult(Value *result) {
-    switch(result->type) {
+    switch(typeOf(result)) {
         case INT_TYPE:
-            printf("%d\n", result->i);
+            printf("%ld\n", fixnumValue(result));
             break;
 
         case DOUBLE_TYPE:
@@ -988,7 +1828,7 @@ void printEvalResult(Value *result) {
             break;
             
         case BOOL_TYPE:
-            if (result->i == 0) {
+            if (result == FALSE_VALUE) {
                 printf("#f\n");
             } else {
                 printf("#t\n");
@@ -997,16 +1837,9 @@ void printEvalResult(Value *result) {
 
         case CONS_TYPE:{
             printf("(");
-            for (Value *curr = result; curr->type != NULL_TYPE; curr = cdr(curr)) {
-                if (car(curr)->type == SINGLEQUOTE_TYPE) {
-                    printf("(quote\n");
-                    curr = cdr(curr);
-                    printEvalResult(car(curr));
-                    printf(")\n");        
-                } else {
-                    printEvalResult(car(curr));
-                }
-                if (cdr(curr)->type != CONS_TYPE && cdr(curr)->type != NULL_TYPE) {
+            for (Value *curr = result; !isNull(curr); curr = cdr(curr)) {
+                printEvalResult(car(curr));
+                if (typeOf(cdr(curr)) != CONS_TYPE && typeOf(cdr(curr)) != NULL_TYPE) {
                     printf(" . ");
                     printEvalResult(cdr(curr));
                     break;
@@ -1,8 +1,91 @@
 #ifndef _INTERPRETER
 #define _INTERPRETER
 
-void interpret(Value *tree);
+// The ways interpret() can run a program: walking the analyzed node trees,
+// which is the reference, or compiling them for the bytecode machine in vm.c.
+typedef enum {
+    TREE_EVALUATOR, BYTECODE_EVALUATOR
+} evaluatorKind;
+
+// Read the program on stdin, or from its cache (cache.h), and run every
+// top-level form in order, printing each result. Each form runs as soon as
+// it has been read (see cacheNext), except with optimize nonzero: the whole program is then read
+// and goes through optimizeProgram() (optimizer.h) before any of it runs.
+// With jit nonzero hot procedures are compiled to machine code (jit.h).
+void interpret(evaluatorKind evaluator, int optimize, int jit);
 Value *eval(Value *expr, Frame *frame);
 
-#endif
+// Make the global frame with every primitive bound in it and return it. It
+// is kept as a global root; call this once, before anything else runs.
+Frame *initGlobalFrame();
+
+// Analyze, optimize if asked and flatten every top-level form of tree into
+// program, which must have room for length(tree) entries, exactly as
+// interpret() runs them.
+void analyzeProgram(Value *tree, Node **program, int optimize);
+
+// Print the value of a top-level form the way interpret() does.
+void printEvalResult(Value *result);
+
+// Box a double; unlike integers, doubles are not immediates.
+Value *makeDouble(double d);
+
+// Check the syntax of expr once and turn it into a tree of nodes that can be
+// run without looking at the syntax again.
+Node *analyze(Value *expr);
+
+// 1 when child runs in a new frame that node makes, else 0.
+int opensFrame(Node *node, int child);
+
+// Allocate a node of the given kind with count children, all NULL, in the
+// old generation; see struct Node for what the fields hold.
+Node *makeNode(nodeKind kind, Value *value, int count);
+
+// Calls of these primitives with two fixnum operands are done right at the
+// call site. analyze() picks the one a CALL_NODE may use from the name of its
+// global operator and stores it in the node's index.
+typedef enum {
+    NO_FAST_PATH, FAST_PLUS, FAST_MINUS, FAST_TIMES, FAST_LESS, FAST_GREATER,
+    FAST_EQUAL
+} fastPath;
+
+// Value of a two-operand call at a call site with the given fast path,
+// computed without calling the primitive. Returns NULL when the fast path
+// does not apply and the call must be made as usual: the operator is not the
+// primitive any more (a user define may have replaced it), an operand is not
+// a fixnum, or the result does not fit in a fixnum.
+Value *fixnumFastPath(fastPath path, Value *procedure, Value *a, Value *b);
 
+// The primitive function the operator of a call site with the given fast path
+// must be for the fast path to apply, or NULL for NO_FAST_PATH.
+Value *(*fastPathPrimitive(fastPath path))(int argc, Value **argv);
+
+// Value of calling a primitive on arguments known before the program runs.
+// Returns NULL when the call would be an error, which must only be reported
+// if the call is reached, or when the primitive must run every time.
+Value *foldPrimitive(Value *procedure, int argc, Value **argv);
+
+// Binding cons cell (symbol . value) of a global variable, or NULL if it has
+// not been defined.
+Value *findTableBinding(Value *key, Frame *frame);
+
+// Binding cons cell of the global variable a VARIABLE_NODE or SET_NODE
+// names, or NULL if it has not been defined. The cell is cached in the node
+// the first time it is found.
+Value *globalBinding(Node *node);
+
+// Value of a local variable run in frame, or of a global one. Both report an
+// unbound variable and exit.
+Value *lookUpLocal(Node *node, Frame *frame);
+Value *lookUpGlobal(Node *node);
+
+// Closure of a LAMBDA_NODE run in frame, holding the variables it captures.
+Value *makeClosure(Node *lambda, Frame *frame);
+
+// Store into a local variable, or into its box if it has one.
+void setLocal(Frame *frame, int index, Value *value);
+
+// Define a global variable, or give an existing one a new value.
+void addBinding(Value *key, Value *value, Frame *frame);
+
+#endif
@@ -0,0 +1,740 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "talloc.h"
+#include "value.h"
+#include "interpreter.h"
+#include "jit.h"
+
+// Native code runs on the machine stack, but everything it holds across a
+// call into the runtime lives in its activation on the JIT stack: the frame
+// it is running in, the closure called, the frame of the call and then the
+// temporaries it needs, such as evaluated operands. The JIT stack is
+// registered with the collector, so those are roots, and native code reloads
+// them from there after every call instead of keeping them in registers.
+#define JIT_THRESHOLD 100
+#define JIT_MAX_TEMPS 64
+#define ACTIVATION_SLOTS 3
+#define CURRENT_FRAME 0
+#define CLOSURE 1
+#define CALL_FRAME 2
+#define CODE_SIZE ((size_t)4 << 20)
+
+// Registers by their encoding. r13 holds the activation while native code runs.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+#define R13 13
+
+// Condition codes of jcc and cmovcc; JUMP is an unconditional jmp.
+#define CC_OVERFLOW 0x0
+#define CC_EQUAL 0x4
+#define CC_NOT_EQUAL 0x5
+#define CC_LESS 0xc
+#define CC_GREATER 0xf
+#define JUMP -1
+
+// Compiled body of a lambda: run takes the activation jitApply set up.
+typedef struct Native {
+    int temps;
+    Value *(*run)(Value **activation);
+} Native;
+
+// Code being generated for one lambda. depth is the number of temporaries in
+// use at the current point and maxDepth the most at any point.
+typedef struct {
+    unsigned char *bytes;
+    int length;
+    int capacity;
+    int depth;
+    int maxDepth;
+    int body;
+    int unsupported;
+    Node *lambda;
+} Assembler;
+
+int jitThreshold = 0;
+int jitDepth = 0;
+
+static Value *(*interpreted)(Value *closure, int argc, Value **argv) = NULL;
+static Value **jitStack = NULL;
+static Value **jitStackTop = NULL;
+static unsigned char *code = NULL;       // executable buffer for all native code
+static unsigned char *codeCursor = NULL;
+static uintptr_t pageSize = 0;
+
+//Helper Functions
+//check (once) whether every lambda should be compiled on its first call
+static int stressMode();
+//append a byte, a 32-bit or a 64-bit little-endian word to the code
+static void emitByte(Assembler *assembler, int byte);
+static void emitInt32(Assembler *assembler, int32_t word);
+static void emitInt64(Assembler *assembler, int64_t word);
+//append an instruction with a 64-bit operand size and a [base + disp32] operand
+static void emitMemory(Assembler *assembler, int opcode, int reg, int base, int32_t disp);
+//append an instruction with a 64-bit operand size and two register operands
+static void emitRegisters(Assembler *assembler, int opcode, int reg, int rm);
+//load a 64-bit constant into a register
+static void emitImmediate(Assembler *assembler, int reg, intptr_t value);
+//compare rax with a sign-extended 32-bit constant
+static void emitCompare(Assembler *assembler, intptr_t value);
+//call a C function; the arguments are already in rdi, rsi and rdx
+static void emitCall(Assembler *assembler, void *function);
+//append a jump whose target is filled in by patchJump; returns its position
+static int emitJump(Assembler *assembler, int condition);
+//make the jump at position land at target
+static void patchJump(Assembler *assembler, int position, int target);
+//store rax into the next temporary
+static void pushTemp(Assembler *assembler);
+//offset of temporary index in the activation
+static int32_t tempOffset(int index);
+//compile node so that its value ends up in rax
+static void compileNode(Assembler *assembler, Node *node, int tail);
+//compile children first onwards of node, keeping the value of the last
+static void compileSequence(Assembler *assembler, Node *node, int first, int tail);
+//load a local or global variable into rax
+static void compileVariable(Assembler *assembler, Node *node);
+//load the frame depth levels out from the current one into reg
+static void compileScope(Assembler *assembler, int reg, int depth);
+//check that rax is a boolean; returns the position of the jump taken on #f
+static int compileCondition(Assembler *assembler, char *message);
+//compile a short-circuiting and or or
+static void compileLogic(Assembler *assembler, Node *node, int tail);
+//compile a cond
+static void compileCond(Assembler *assembler, Node *node, int tail);
+//compile a let, let* or letrec
+static void compileLet(Assembler *assembler, Node *node, int tail);
+//compile a call, with the fixnum fast path and self tail calls inline
+static void compileCall(Assembler *assembler, Node *node, int tail);
+//runtime entry points called from native code
+static Value *callSite(Node *node, Value **operands);
+static void enterFrame(Value **activation, Node *node, Value **inits);
+static void setGlobal(Node *node, Value *value);
+static void fail(char *message);
+static void failNode(Node *node);
+
+void jitInit(int enabled, Value *(*run)(Value *closure, int argc, Value **argv)){
+    interpreted = run;
+#if defined(__x86_64__)
+    jitThreshold = !enabled ? 0 : stressMode() ? 1 : JIT_THRESHOLD;
+#else
+    jitThreshold = 0;
+#endif
+    if (jitThreshold == 0 || jitStack != NULL) {
+        return;
+    }
+
+    // every activation fits, so the stack never has to grow
+    jitStack = tallocTenured(sizeof(Value *) * JIT_MAX_DEPTH * (ACTIVATION_SLOTS + JIT_MAX_TEMPS), RAW_KIND);
+    jitStackTop = jitStack;
+    gcAddGlobalRoot(&jitStack);
+    gcAddRootStack(&jitStack, &jitStackTop);
+}
+
+// A closure the frame stack has no room for is left to the evaluator, so
+// native code only ever runs in frames that do not move.
+Value *jitApply(Value *closure, int argc, Value **argv){
+    Node *lambda = closure->closure.code;
+    if (lambda->index != argc) {
+        printf("Evaluation error: incurrent number of arguments of procedure\n");
+        texit(0);
+    }
+
+    void *mark = frameStackMark();
+    Frame *frame = tallocStackFrame(lambda->frameSize);
+    if ((char *)frame < frameStack || (char *)frame >= frameStackTop) {
+        return interpreted(closure, argc, argv);
+    }
+    frame->parent = closure->closure.frame;
+    memcpy(frame->slots, argv, sizeof(Value *) * argc);
+
+    Value **activation = jitStackTop;
+    activation[CURRENT_FRAME] = (Value *)frame;
+    activation[CLOSURE] = closure;
+    activation[CALL_FRAME] = (Value *)frame;
+    memset(activation + ACTIVATION_SLOTS, 0, sizeof(Value *) * lambda->native->temps);
+    jitStackTop = activation + ACTIVATION_SLOTS + lambda->native->temps;
+
+    jitDepth++;
+    Value *result = lambda->native->run(activation);
+    jitDepth--;
+
+    jitStackTop = activation;
+    frameStackRelease(mark);
+    return result;
+}
+
+// The code is generated into a growable buffer first and copied into the
+// executable one only if the whole body could be compiled. A rest parameter
+// makes the body unsupported, as does a global define. The pages the code
+// goes in are writable only while it is copied, and executable only after,
+// so no page is ever both. No native code runs during the copy: the only
+// native code below it on the stack is waiting for a call to return.
+void jitCompile(Node *lambda){
+    if (typeOf(lambda->value) == SYMBOL_TYPE) {
+        return;
+    }
+    if (code == NULL) {
+        code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            code = NULL;
+            jitThreshold = 0;
+            return;
+        }
+        codeCursor = code;
+        pageSize = sysconf(_SC_PAGESIZE);
+    }
+
+    Assembler assembler = {NULL, 0, 0, 0, 0, 0, 0, lambda};
+    // push r13; mov r13, rdi
+    emitByte(&assembler, 0x41);
+    emitByte(&assembler, 0x55);
+    emitRegisters(&assembler, 0x89, RDI, R13);
+    assembler.body = assembler.length;
+    compileNode(&assembler, lambda->children[0], 1);
+    // pop r13; ret
+    emitByte(&assembler, 0x41);
+    emitByte(&assembler, 0x5d);
+    emitByte(&assembler, 0xc3);
+
+    if (assembler.unsupported || assembler.maxDepth > JIT_MAX_TEMPS
+        || (size_t)(code + CODE_SIZE - codeCursor) < (size_t)assembler.length) {
+        free(assembler.bytes);
+        return;
+    }
+    unsigned char *pages = (unsigned char *)((uintptr_t)codeCursor & ~(pageSize - 1));
+    size_t span = codeCursor + assembler.length - pages;
+    if (mprotect(pages, span, PROT_READ | PROT_WRITE) != 0) {
+        free(assembler.bytes);
+        jitThreshold = 0;
+        return;
+    }
+    memcpy(codeCursor, assembler.bytes, assembler.length);
+    if (mprotect(pages, span, PROT_READ | PROT_EXEC) != 0) {
+        free(assembler.bytes);
+        jitThreshold = 0;
+        return;
+    }
+    Native *native = malloc(sizeof(Native));
+    if (native == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    native->temps = assembler.maxDepth;
+    native->run = (Value *(*)(Value **))codeCursor;
+    codeCursor += (assembler.length + 15) & ~15;
+    free(assembler.bytes);
+    lambda->native = native;
+}
+
+static void compileNode(Assembler *assembler, Node *node, int tail) {
+    switch (node->kind) {
+        case CONSTANT_NODE:
+            // a heap constant may still be moved, but its node never is
+            if (isImmediate(node->value)) {
+                emitImmediate(assembler, RAX, (intptr_t)node->value);
+            } else {
+                emitImmediate(assembler, RAX, (intptr_t)&node->value);
+                emitMemory(assembler, 0x8b, RAX, RAX, 0);
+            }
+            break;
+
+        case VARIABLE_NODE:
+            compileVariable(assembler, node);
+            break;
+
+        case IF_NODE: {
+            compileNode(assembler, node->children[0], 0);
+            int otherwise = compileCondition(assembler, "Evaluation error: condition of an if expression must be a boolean");
+            compileNode(assembler, node->children[1], tail);
+            int end = emitJump(assembler, JUMP);
+            patchJump(assembler, otherwise, assembler->length);
+            compileNode(assembler, node->children[2], tail);
+            patchJump(assembler, end, assembler->length);
+            break;
+        }
+
+        case SET_NODE:
+        case DEFINE_NODE:
+            compileNode(assembler, node->children[0], 0);
+            if (node->depth < 0 && node->kind == DEFINE_NODE) {
+                assembler->unsupported = 1;
+            } else if (node->depth < 0) {
+                emitImmediate(assembler, RDI, (intptr_t)node);
+                emitRegisters(assembler, 0x89, RAX, RSI);
+                emitCall(assembler, setGlobal);
+            } else {
+                compileScope(assembler, RDI, node->depth);
+                emitImmediate(assembler, RSI, node->index);
+                emitRegisters(assembler, 0x89, RAX, RDX);
+                emitCall(assembler, setLocal);
+            }
+            emitImmediate(assembler, RAX, (intptr_t)VOID_VALUE);
+            break;
+
+        case LET_NODE:
+        case LETSTAR_NODE:
+        case LETREC_NODE:
+            compileLet(assembler, node, tail);
+            break;
+
+        case BEGIN_NODE:
+            if (node->count == 0) {
+                emitImmediate(assembler, RAX, (intptr_t)VOID_VALUE);
+            } else {
+                compileSequence(assembler, node, 0, tail);
+            }
+            break;
+
+        case AND_NODE:
+        case OR_NODE:
+            compileLogic(assembler, node, tail);
+            break;
+
+        case COND_NODE:
+            compileCond(assembler, node, tail);
+            break;
+
+        case LAMBDA_NODE:
+            emitImmediate(assembler, RDI, (intptr_t)node);
+            emitMemory(assembler, 0x8b, RSI, R13, CURRENT_FRAME * 8);
+            emitCall(assembler, makeClosure);
+            break;
+
+        case CALL_NODE:
+            compileCall(assembler, node, tail);
+            break;
+
+        case ERROR_NODE:
+            emitImmediate(assembler, RDI, (intptr_t)node);
+            emitCall(assembler, failNode);
+            break;
+    }
+}
+
+static void compileSequence(Assembler *assembler, Node *node, int first, int tail) {
+    for (int i = first; i < node->count; i++) {
+        compileNode(assembler, node->children[i], tail && i == node->count - 1);
+    }
+}
+
+// Globals are read through the binding cell cached in the node, as the
+// evaluators do; lookUpGlobal finds it the first time and reports an unbound
+// variable. A boxed local is left to lookUpLocal.
+static void compileVariable(Assembler *assembler, Node *node) {
+    if (node->depth < 0) {
+        emitImmediate(assembler, RAX, (intptr_t)&node->binding);
+        emitMemory(assembler, 0x8b, RAX, RAX, 0);
+        // test rax, rax
+        emitRegisters(assembler, 0x85, RAX, RAX);
+        int cached = emitJump(assembler, CC_NOT_EQUAL);
+        emitImmediate(assembler, RDI, (intptr_t)node);
+        emitCall(assembler, lookUpGlobal);
+        int end = emitJump(assembler, JUMP);
+        patchJump(assembler, cached, assembler->length);
+        emitMemory(assembler, 0x8b, RAX, RAX, offsetof(Value, c.cdr));
+        patchJump(assembler, end, assembler->length);
+        return;
+    }
+    if (node->boxed) {
+        emitImmediate(assembler, RDI, (intptr_t)node);
+        emitMemory(assembler, 0x8b, RSI, R13, CURRENT_FRAME * 8);
+        emitCall(assembler, lookUpLocal);
+        return;
+    }
+
+    compileScope(assembler, RAX, node->depth);
+    emitMemory(assembler, 0x8b, RAX, RAX, offsetof(Frame, slots) + sizeof(Value *) * node->index);
+    emitRegisters(assembler, 0x85, RAX, RAX);
+    int bound = emitJump(assembler, CC_NOT_EQUAL);
+    emitImmediate(assembler, RDI, (intptr_t)"Evaluation error: variable that is not bound in the current frame or any of its ancestors");
+    emitCall(assembler, fail);
+    patchJump(assembler, bound, assembler->length);
+}
+
+static void compileScope(Assembler *assembler, int reg, int depth) {
+    emitMemory(assembler, 0x8b, reg, R13, CURRENT_FRAME * 8);
+    for (int i = 0; i < depth; i++) {
+        emitMemory(assembler, 0x8b, reg, reg, offsetof(Frame, parent));
+    }
+}
+
+static int compileCondition(Assembler *assembler, char *message) {
+    emitCompare(assembler, (intptr_t)FALSE_VALUE);
+    int otherwise = emitJump(assembler, CC_EQUAL);
+    emitCompare(assembler, (intptr_t)TRUE_VALUE);
+    int boolean = emitJump(assembler, CC_EQUAL);
+    emitImmediate(assembler, RDI, (intptr_t)message);
+    emitCall(assembler, fail);
+    patchJump(assembler, boolean, assembler->length);
+    return otherwise;
+}
+
+// Every operand but the last jumps to the end with its value when it
+// decides the result.
+static void compileLogic(Assembler *assembler, Node *node, int tail) {
+    if (node->count == 0) {
+        emitImmediate(assembler, RAX, (intptr_t)(node->kind == AND_NODE ? TRUE_VALUE : FALSE_VALUE));
+        return;
+    }
+    int *exits = malloc(sizeof(int) * node->count);
+    if (exits == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    for (int i = 0; i < node->count - 1; i++) {
+        compileNode(assembler, node->children[i], 0);
+        emitCompare(assembler, (intptr_t)FALSE_VALUE);
+        exits[i] = emitJump(assembler, node->kind == AND_NODE ? CC_EQUAL : CC_NOT_EQUAL);
+    }
+    compileNode(assembler, node->children[node->count - 1], tail);
+    for (int i = 0; i < node->count - 1; i++) {
+        patchJump(assembler, exits[i], assembler->length);
+    }
+    free(exits);
+}
+
+// Clauses are tried in order up to an else clause; with none taken the value
+// is void.
+static void compileCond(Assembler *assembler, Node *node, int tail) {
+    int *exits = malloc(sizeof(int) * (node->count / 2 + 1));
+    if (exits == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    int exitCount = 0;
+    int step = 0;
+    for (; step < node->count; step += 2) {
+        if (node->children[step] == NULL) {
+            compileNode(assembler, node->children[step + 1], tail);
+            break;
+        }
+        compileNode(assembler, node->children[step], 0);
+        int next = compileCondition(assembler, "Evaluation error [cond]: incorrect type in condition");
+        // a clause the analyzer rejected has an error for a test and no body
+        if (node->children[step + 1] != NULL) {
+            compileNode(assembler, node->children[step + 1], tail);
+        }
+        exits[exitCount++] = emitJump(assembler, JUMP);
+        patchJump(assembler, next, assembler->length);
+    }
+    if (step >= node->count) {
+        emitImmediate(assembler, RAX, (intptr_t)VOID_VALUE);
+    }
+    for (int i = 0; i < exitCount; i++) {
+        patchJump(assembler, exits[i], assembler->length);
+    }
+    free(exits);
+}
+
+// A let's initializers run in the enclosing frame and are collected in
+// temporaries; let* and letrec make the frame first and bind each name in
+// it as the evaluators do. The frame is made on the frame stack by
+// enterFrame and left by going back to its parent; it is released with the
+// whole call.
+static void compileLet(Assembler *assembler, Node *node, int tail) {
+    int first = assembler->depth;
+    if (node->kind == LET_NODE) {
+        for (int i = 0; i < node->index; i++) {
+            compileNode(assembler, node->children[i], 0);
+            pushTemp(assembler);
+        }
+    }
+    emitRegisters(assembler, 0x89, R13, RDI);
+    emitImmediate(assembler, RSI, (intptr_t)node);
+    emitMemory(assembler, 0x8d, RDX, R13, tempOffset(first));
+    emitCall(assembler, enterFrame);
+    assembler->depth = first;
+
+    if (node->kind == LETREC_NODE) {
+        for (int i = 0; i < node->index; i++) {
+            compileNode(assembler, node->children[i], 0);
+            pushTemp(assembler);
+        }
+        for (int i = 0; i < node->index; i++) {
+            emitMemory(assembler, 0x8b, RDI, R13, CURRENT_FRAME * 8);
+            emitImmediate(assembler, RSI, i);
+            emitMemory(assembler, 0x8b, RDX, R13, tempOffset(first + i));
+            emitCall(assembler, setLocal);
+        }
+        assembler->depth = first;
+    }
+
+    compileSequence(assembler, node, node->kind == LETSTAR_NODE ? 0 : node->index, tail);
+    emitMemory(assembler, 0x8b, RCX, R13, CURRENT_FRAME * 8);
+    emitMemory(assembler, 0x8b, RCX, RCX, offsetof(Frame, parent));
+    emitMemory(assembler, 0x89, RCX, R13, CURRENT_FRAME * 8);
+}
+
+// The operator and operands are evaluated into temporaries. A call site with
+// a fast path adds, subtracts or compares two fixnums right here when the
+// operator is still the primitive; multiplication and every other call go
+// through callSite. A tail call of the closure being run reuses its frame
+// and jumps back to the start of the body, so loops run in constant space.
+static void compileCall(Assembler *assembler, Node *node, int tail) {
+    int first = assembler->depth;
+    int argc = node->count - 1;
+    for (int i = 0; i < node->count; i++) {
+        compileNode(assembler, node->children[i], 0);
+        pushTemp(assembler);
+    }
+
+    int slowPaths[6];
+    int slowCount = 0;
+    int end = -1;
+    fastPath path = node->index;
+    if (path != NO_FAST_PATH && path != FAST_TIMES && argc == 2) {
+        // the operator must be the primitive
+        emitMemory(assembler, 0x8b, RCX, R13, tempOffset(first));
+        emitByte(assembler, 0xf6);          // test cl, 3
+        emitByte(assembler, 0xc1);
+        emitByte(assembler, 0x03);
+        slowPaths[slowCount++] = emitJump(assembler, CC_NOT_EQUAL);
+        emitByte(assembler, 0x81);          // cmp dword [rcx], PRIMITIVE_TYPE
+        emitByte(assembler, 0x39);
+        emitInt32(assembler, PRIMITIVE_TYPE);
+        slowPaths[slowCount++] = emitJump(assembler, CC_NOT_EQUAL);
+        emitImmediate(assembler, RSI, (intptr_t)fastPathPrimitive(path));
+        emitMemory(assembler, 0x3b, RSI, RCX, offsetof(Value, primFn));
+        slowPaths[slowCount++] = emitJump(assembler, CC_NOT_EQUAL);
+
+        // both operands must be fixnums
+        emitMemory(assembler, 0x8b, RAX, R13, tempOffset(first + 1));
+        emitMemory(assembler, 0x8b, RDX, R13, tempOffset(first + 2));
+        emitRegisters(assembler, 0x89, RAX, RCX);
+        emitRegisters(assembler, 0x21, RDX, RCX);
+        emitByte(assembler, 0xf6);          // test cl, 1
+        emitByte(assembler, 0xc1);
+        emitByte(assembler, 0x01);
+        slowPaths[slowCount++] = emitJump(assembler, CC_EQUAL);
+
+        // (2x + 1) - 1 + (2y + 1) and (2x + 1) - (2y + 1) + 1 overflow exactly
+        // when the fixnum result would
+        if (path == FAST_PLUS) {
+            emitMemory(assembler, 0x8d, RAX, RAX, -1);
+            emitRegisters(assembler, 0x01, RDX, RAX);
+            slowPaths[slowCount++] = emitJump(assembler, CC_OVERFLOW);
+        } else if (path == FAST_MINUS) {
+            emitRegisters(assembler, 0x29, RDX, RAX);
+            slowPaths[slowCount++] = emitJump(assembler, CC_OVERFLOW);
+            emitMemory(assembler, 0x8d, RAX, RAX, 1);
+        } else {
+            // cmp rax, rdx; mov rax, #f; mov rcx, #t; cmovcc rax, rcx
+            emitRegisters(assembler, 0x39, RDX, RAX);
+            emitImmediate(assembler, RAX, (intptr_t)FALSE_VALUE);
+            emitImmediate(assembler, RCX, (intptr_t)TRUE_VALUE);
+            int condition = path == FAST_LESS ? CC_LESS : path == FAST_GREATER ? CC_GREATER : CC_EQUAL;
+            emitRegisters(assembler, 0x0f40 + condition, RAX, RCX);
+        }
+        end = emitJump(assembler, JUMP);
+    } else if (tail && path == NO_FAST_PATH && argc == assembler->lambda->index) {
+        emitMemory(assembler, 0x8b, RAX, R13, tempOffset(first));
+        emitMemory(assembler, 0x3b, RAX, R13, CLOSURE * 8);
+        slowPaths[slowCount++] = emitJump(assembler, CC_NOT_EQUAL);
+
+        // the call frame gets the new arguments and its other slots are
+        // unbound again, as in a fresh frame
+        emitMemory(assembler, 0x8b, RCX, R13, CALL_FRAME * 8);
+        for (int i = 0; i < assembler->lambda->frameSize; i++) {
+            if (i < argc) {
+                emitMemory(assembler, 0x8b, RAX, R13, tempOffset(first + 1 + i));
+            } else {
+                emitImmediate(assembler, RAX, 0);
+            }
+            emitMemory(assembler, 0x89, RAX, RCX, offsetof(Frame, slots) + sizeof(Value *) * i);
+        }
+        emitMemory(assembler, 0x89, RCX, R13, CURRENT_FRAME * 8);
+
+        // release every frame above it and stop at a requested collection
+        emitMemory(assembler, 0x8d, RAX, RCX, sizeof(Frame) + sizeof(Value *) * assembler->lambda->frameSize);
+        emitImmediate(assembler, RDX, (intptr_t)&frameStackTop);
+        emitMemory(assembler, 0x89, RAX, RDX, 0);
+        emitImmediate(assembler, RAX, (intptr_t)&gcRequested);
+        emitByte(assembler, 0x83);          // cmp dword [rax], 0
+        emitByte(assembler, 0x38);
+        emitByte(assembler, 0x00);
+        int requested = emitJump(assembler, CC_EQUAL);
+        emitCall(assembler, gcCollectRequested);
+        patchJump(assembler, requested, assembler->length);
+        patchJump(assembler, emitJump(assembler, JUMP), assembler->body);
+    }
+
+    for (int i = 0; i < slowCount; i++) {
+        patchJump(assembler, slowPaths[i], assembler->length);
+    }
+    emitImmediate(assembler, RDI, (intptr_t)node);
+    emitMemory(assembler, 0x8d, RSI, R13, tempOffset(first));
+    emitCall(assembler, callSite);
+    if (end >= 0) {
+        patchJump(assembler, end, assembler->length);
+    }
+    assembler->depth = first;
+}
+
+// Everything native code holds is in its activation, so a call is a
+// safepoint.
+static Value *callSite(Node *node, Value **operands) {
+    if (gcRequested) {
+        gcCollectRequested();
+    }
+    Value *procedure = operands[0];
+    int argc = node->count - 1;
+    if (node->index != NO_FAST_PATH) {
+        Value *value = fixnumFastPath(node->index, procedure, operands[1], operands[2]);
+        if (value != NULL) {
+            return value;
+        }
+    }
+    if (typeOf(procedure) == CLOSURE_TYPE) {
+        if (jitReady(procedure->closure.code)) {
+            return jitApply(procedure, argc, operands + 1);
+        }
+        return interpreted(procedure, argc, operands + 1);
+    }
+    if (typeOf(procedure) == PRIMITIVE_TYPE) {
+        return (procedure->primFn)(argc, operands + 1);
+    }
+    printf("Evaluation error: undefined procedure\n");
+    texit(0);
+    return NULL;
+}
+
+// The new frame is the newest object, so it needs no barrier.
+static void enterFrame(Value **activation, Node *node, Value **inits) {
+    Frame *frame = tallocStackFrame(node->frameSize);
+    frame->parent = (Frame *)activation[CURRENT_FRAME];
+    if (node->kind == LET_NODE) {
+        memcpy(frame->slots, inits, sizeof(Value *) * node->index);
+    }
+    activation[CURRENT_FRAME] = (Value *)frame;
+}
+
+// Setting a global that is bound nowhere does nothing.
+static void setGlobal(Node *node, Value *value) {
+    Value *bindingCons = globalBinding(node);
+    if (bindingCons != NULL) {
+        bindingCons->c.cdr = value;
+        gcWriteBarrier(bindingCons);
+    }
+}
+
+static void fail(char *message) {
+    printf("%s\n", message);
+    texit(0);
+}
+
+static void failNode(Node *node) {
+    printf("%s\n", node->value->s);
+    texit(0);
+}
+
+static void pushTemp(Assembler *assembler) {
+    emitMemory(assembler, 0x89, RAX, R13, tempOffset(assembler->depth));
+    assembler->depth++;
+    if (assembler->depth > assembler->maxDepth) {
+        assembler->maxDepth = assembler->depth;
+    }
+}
+
+static int32_t tempOffset(int index) {
+    return (int32_t)(sizeof(Value *) * (ACTIVATION_SLOTS + index));
+}
+
+static void emitByte(Assembler *assembler, int byte) {
+    if (assembler->length == assembler->capacity) {
+        assembler->capacity = assembler->capacity == 0 ? 1024 : assembler->capacity * 2;
+        assembler->bytes = realloc(assembler->bytes, assembler->capacity);
+        if (assembler->bytes == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+    }
+    assembler->bytes[assembler->length++] = (unsigned char)byte;
+}
+
+static void emitInt32(Assembler *assembler, int32_t word) {
+    for (int i = 0; i < 4; i++) {
+        emitByte(assembler, (uint32_t)word >> (8 * i) & 0xff);
+    }
+}
+
+static void emitInt64(Assembler *assembler, int64_t word) {
+    for (int i = 0; i < 8; i++) {
+        emitByte(assembler, (uint64_t)word >> (8 * i) & 0xff);
+    }
+}
+
+// REX.W, the opcode, then ModRM with mod 10 (a 32-bit displacement); a base
+// of rsp or r12 needs a SIB byte.
+static void emitMemory(Assembler *assembler, int opcode, int reg, int base, int32_t disp) {
+    emitByte(assembler, 0x48 | (reg >> 3) << 2 | base >> 3);
+    emitByte(assembler, opcode);
+    emitByte(assembler, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == 4) {
+        emitByte(assembler, 0x24);
+    }
+    emitInt32(assembler, disp);
+}
+
+// Two-byte opcodes are passed as 0x0fXX.
+static void emitRegisters(Assembler *assembler, int opcode, int reg, int rm) {
+    emitByte(assembler, 0x48 | (reg >> 3) << 2 | rm >> 3);
+    if (opcode > 0xff) {
+        emitByte(assembler, opcode >> 8);
+    }
+    emitByte(assembler, opcode & 0xff);
+    emitByte(assembler, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emitImmediate(Assembler *assembler, int reg, intptr_t value) {
+    emitByte(assembler, 0x48 | reg >> 3);
+    emitByte(assembler, 0xb8 + (reg & 7));
+    emitInt64(assembler, value);
+}
+
+static void emitCompare(Assembler *assembler, intptr_t value) {
+    emitByte(assembler, 0x48);
+    emitByte(assembler, 0x3d);
+    emitInt32(assembler, (int32_t)value);
+}
+
+static void emitCall(Assembler *assembler, void *function) {
+    emitImmediate(assembler, RAX, (intptr_t)function);
+    emitByte(assembler, 0xff);
+    emitByte(assembler, 0xd0);
+}
+
+static int emitJump(Assembler *assembler, int condition) {
+    if (condition == JUMP) {
+        emitByte(assembler, 0xe9);
+    } else {
+        emitByte(assembler, 0x0f);
+        emitByte(assembler, 0x80 + condition);
+    }
+    int position = assembler->length;
+    emitInt32(assembler, 0);
+    return position;
+}
+
+static void patchJump(Assembler *assembler, int position, int target) {
+    int32_t offset = target - (position + 4);
+    memcpy(assembler->bytes + position, &offset, sizeof(offset));
+}
+
+// Compiling everything on its first call is opt-in: set JIT_STRESS=1.
+static int stressMode() {
+    static int cached = -1;
+    if (cached == -1) {
+        char *setting = getenv("JIT_STRESS");
+        cached = setting != NULL && setting[0] != '\0' && setting[0] != '0';
+    }
+    return cached;
+}
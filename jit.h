@@ -0,0 +1,52 @@
+#include "value.h"
+
+#ifndef _JIT
+#define _JIT
+
+// Closures whose lambda is called often are compiled to x86-64 machine code.
+// Each call of a closure counts towards its LAMBDA_NODE; at the threshold the
+// body is compiled once into an executable buffer, and from then on calls of
+// it run the machine code. The code keeps fixnum arithmetic and comparisons,
+// variable references, branches and self tail calls inline, and calls into
+// the runtime for allocation, other calls and errors, so it behaves exactly
+// like the evaluator that would run the body otherwise. A lambda the compiler
+// cannot handle is left to the evaluator. Set JIT_STRESS=1 to compile every
+// lambda on its first call. On other machines nothing is ever compiled.
+
+// Calls a lambda needs before it is compiled; 0 when compiling is off.
+extern int jitThreshold;
+
+// Native activations on the C stack.
+extern int jitDepth;
+
+// Most native activations nested on the C stack; calls past it are run by
+// the evaluator, which keeps deep recursion off the C stack.
+#define JIT_MAX_DEPTH 1000
+
+// Turn compiling on or off and name the function that runs a closure call
+// natively compiled code cannot: interpreted runs closure on argc arguments
+// with the evaluator in use and returns its value.
+void jitInit(int enabled, Value *(*interpreted)(Value *closure, int argc, Value **argv));
+
+// Compile the body of lambda if it can be; called once, at the threshold.
+void jitCompile(Node *lambda);
+
+// Count a call of lambda and say whether it should run natively.
+ALWAYS_INLINE int jitReady(Node *lambda) {
+    if (lambda->native == NULL) {
+        if (lambda->calls >= jitThreshold || ++lambda->calls < jitThreshold) {
+            return 0;
+        }
+        jitCompile(lambda);
+        if (lambda->native == NULL) {
+            return 0;
+        }
+    }
+    return jitDepth < JIT_MAX_DEPTH;
+}
+
+// Call a closure whose lambda jitReady() accepted on argc arguments, which
+// are copied before anything else happens, and return its value.
+Value *jitApply(Value *closure, int argc, Value **argv);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "value.h"
+#include "talloc.h"
+#include "tokenizer.h"
+
+// Microbenchmark of the tokenizer alone: time nextToken() over a file and
+// report its throughput. Without a file it lexes data it generates, the
+// kind large data-bearing programs have: comment blocks and indented quoted
+// lists of integers, decimals, symbols and strings. `make lexbench` runs it
+// with the vector kernels and then with TOKENIZER_SCALAR set.
+
+//helper functions
+
+//write the generated data to a temporary file and return its descriptor
+int generate(long forms);
+
+int main(int argc, char **argv) {
+    int input = argc > 1 ? open(argv[1], O_RDONLY) : generate(400);
+    if (input < 0) {
+        printf("Usage: %s [program.scm]\n", argv[0]);
+        return 1;
+    }
+    struct stat status;
+    fstat(input, &status);
+    dup2(input, 0);
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long tokens = 0;
+    while (nextToken() != NULL) {
+        tokens++;
+        // nothing keeps the tokens, so every collection is short
+        if (gcRequested) {
+            gcCollectRequested();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    double megabytes = status.st_size / 1e6;
+    printf("%s kernels: %.1f MB, %ld tokens in %.3f s: %.1f MB/s, %.1f Mtokens/s\n",
+           getenv("TOKENIZER_SCALAR") != NULL ? "scalar" : "vector",
+           megabytes, tokens, seconds, megabytes / seconds, tokens / seconds / 1e6);
+    tfree();
+    return 0;
+}
+
+int generate(long forms) {
+    FILE *data = tmpfile();
+    srand(1);
+    for (long form = 0; form < forms; form++) {
+        for (int line = 0; line < 8; line++) {
+            fprintf(data, ";; block %ld of generated data: a comment line of the length"
+                    " documentation tends to have\n", form);
+        }
+        fprintf(data, "(define data%ld\n  (quote (", form);
+        for (int i = 0; i < 10000; i++) {
+            switch (i % 4) {
+                case 0:
+                    fprintf(data, "%d ", rand() - RAND_MAX / 2);
+                    break;
+
+                case 1:
+                    fprintf(data, "%d.%03d ", rand() % 10000, rand() % 1000);
+                    break;
+
+                case 2:
+                    fprintf(data, "item-%d ", rand() % 500);
+                    break;
+
+                default:
+                    fprintf(data, "\"string number %d\" ", i);
+                    break;
+            }
+            if (i % 16 == 15) {
+                fprintf(data, "\n           ");
+            }
+        }
+        fprintf(data, ")))\n");
+    }
+    fflush(data);
+    rewind(data);
+    return fileno(data);
+}
@@ -6,17 +6,16 @@
 #include "talloc.h"
 
 // Create a new NULL_TYPE value node.
-// As the tail of a list
+// As the tail of a list. The empty list is an immediate, so nothing is
+// allocated.
 Value *makeNull() {
-    Value *newNode = talloc(sizeof(Value)); 
-    newNode->type = NULL_TYPE;
-    return newNode;
+    return NULL_VALUE;
 }
 
 // Create a new CONS_TYPE value node.
 // Usage: head = cons(value, head);
 Value *cons(Value *newCar, Value *newCdr) {
-    Value *newCons = talloc(sizeof(Value));
+    Value *newCons = tallocValue();
     newCons->type = CONS_TYPE;
     newCons->c.car = newCar;
     newCons->c.cdr = newCdr;
@@ -35,10 +34,10 @@ void display(Value *list) {
     printf("(");
     
     while(!isNull(curr)){
-        assert(curr->type == CONS_TYPE && "Error (display): not pointing to a cons type");     
-        switch(car(curr)->type){
+        assert(typeOf(curr) == CONS_TYPE && "Error (display): not pointing to a cons type");     
+        switch(typeOf(car(curr))){
             case INT_TYPE:
-                printf("%i, ", car(curr)->i);
+                printf("%li, ", fixnumValue(car(curr)));
                 break;
             case DOUBLE_TYPE:
                 printf("%lf, ", car(curr)->d);
@@ -66,7 +65,7 @@ Value *reverse(Value *list) {
 
     Value *newHead = makeNull();
 
-    for (Value *curr = list; curr->type != NULL_TYPE; curr=cdr(curr)) {
+    for (Value *curr = list; !isNull(curr); curr=cdr(curr)) {
         // switch(car(curr)->type){
         //     case INT_TYPE:
         //         newCar->i = car(curr)->i;
@@ -103,7 +102,7 @@ Value *car(Value *list) {
 // that this is a legitimate operation.
 Value *cdr(Value *list) {
     assert(list != NULL && "Error (cdr): input list is NULL");
-    assert(list->type == CONS_TYPE && "Error (cdr): not pointing to a cons type");
+    assert(typeOf(list) == CONS_TYPE && "Error (cdr): not pointing to a cons type");
     return list->c.cdr;
 }
 
@@ -111,7 +110,7 @@ Value *cdr(Value *list) {
 // that this is a legitimate operation.
 bool isNull(Value *value){
     assert(value != NULL && "Error (isNull): input list is NULL");
-    return value->type == NULL_TYPE;
+    return value == NULL_VALUE;
 }
 
 // Measure length of list. Use assertions to make sure that this is a legitimate
@@ -120,8 +119,8 @@ int length(Value *value){
     assert(value != NULL && "Error (length): input list is NULL");
     int count = 0; 
     
-    for (Value *curr = value; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        assert(curr->type == CONS_TYPE && "Error (length): not pointing to a cons type");
+    for (Value *curr = value; !isNull(curr); curr = cdr(curr)) {
+        assert(typeOf(curr) == CONS_TYPE && "Error (length): not pointing to a cons type");
         count++;
     }
 
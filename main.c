@@ -1,16 +1,52 @@
 #include <stdio.h>
+#include <string.h>
 #include "tokenizer.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "interpreter.h"
+#include "aot.h"
+#include "cache.h"
 
-int main() {
+int main(int argc, char **argv) {
 
-    Value *list = tokenize();
-    Value *tree = parse(list);
-    interpret(tree);
+    // --vm runs the program on the bytecode machine instead of the tree
+    // evaluator; --optimize runs the optimizer over it first; --no-jit keeps
+    // hot procedures from being compiled to machine code; --compile writes
+    // the program out as C instead of running it (aot.h). A program named
+    // on the command line is read from that file and cached next to it
+    // (cache.h); otherwise it is read from stdin.
+    evaluatorKind evaluator = TREE_EVALUATOR;
+    int optimize = 0;
+    int jit = 1;
+    int compile = 0;
+    char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--vm") == 0) {
+            evaluator = BYTECODE_EVALUATOR;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            optimize = 1;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            jit = 0;
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile = 1;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            printf("Usage: %s [--vm] [--optimize] [--no-jit] [--compile] [program.scm | < program.scm]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (path != NULL) {
+        cacheOpen(path);
+    }
+    if (compile) {
+        aotCompile(cacheProgram(), optimize);
+    } else {
+        interpret(evaluator, optimize, jit);
+    }
 
     tfree();
     return 0;
@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "linkedlist.h"
+#include "talloc.h"
+#include "value.h"
+#include "interpreter.h"
+#include "optimizer.h"
+
+// Most nodes the body of a procedure may have for its calls to be inlined.
+#define INLINE_BUDGET 24
+// Most inlined bodies that may be nested inside each other at one call site.
+#define INLINE_DEPTH 4
+
+// What the optimizer knows about a global written somewhere in the program,
+// in a table keyed by its symbol, which is interned and never moves.
+typedef struct {
+    Value *name;
+    int assigned;      // number of defines and set!s of it
+    Node *inlinable;   // the procedure it is defined as, if calls can be inlined
+} Global;
+
+// What the optimizer knows about the whole program and where it is in it:
+// - the global frame holding the primitives;
+// - every global with a define or set! anywhere in the program, since a
+//   global that is written may not hold its primitive or procedure when a
+//   call runs;
+// - which of those are procedures of earlier top-level forms that can be
+//   inlined, and the names of the ones being inlined right now;
+// - the nodes whose frames enclose the node being optimized, innermost last.
+typedef struct {
+    Frame *globalFrame;
+    Global *globals;
+    int globalCount;
+    int globalCapacity;
+    Value **expanding;
+    int expandingCount;
+    int expandingCapacity;
+    Node **scopes;
+    int scopeCount;
+    int scopeCapacity;
+} Optimizer;
+
+//Helper Functions
+//make room for one more entry in a growable array
+static void *reserve(void *array, int count, int *capacity, size_t size);
+//record every global defined or set anywhere in node
+static void collectAssigned(Optimizer *optimizer, Node *node);
+//entry of a global in the table, added when add is nonzero; else NULL if absent
+static Global *findGlobal(Optimizer *optimizer, Value *name, int add);
+//slot of a global in the table, or the empty slot where it would go
+static int globalSlot(Optimizer *optimizer, Value *name);
+//number of defines and set!s of a global in the program
+static int timesAssigned(Optimizer *optimizer, Value *name);
+//remember the procedure a top-level form defines if its calls can be inlined
+static void addInlinable(Optimizer *optimizer, Node *form);
+//optimize node and its children, returning the node to run in its place
+static Node *optimizeNode(Optimizer *optimizer, Node *node);
+//optimize a let whose initializers have been optimized
+static Node *optimizeLet(Optimizer *optimizer, Node *node);
+//put the value of binding i of a let or let* into its body if it is known
+static int propagateBinding(Optimizer *optimizer, Node *node, int i);
+//nonzero when a local variable is bound before it can be read and never written
+static int isBound(Optimizer *optimizer, Node *variable, int *written);
+//nonzero when running node cannot write a variable or call a procedure
+static int isPure(Optimizer *optimizer, Node *node);
+//the call's value if it is a primitive call that can be made now, else node
+static Node *foldCall(Optimizer *optimizer, Node *node);
+//the body of the called procedure in place of the call, if it can be inlined
+static Node *inlineCall(Optimizer *optimizer, Node *node);
+//the node of the let body when every binding has gone into it, else node
+static Node *elideFrame(Node *node);
+//drop the clauses of a cond that can never be chosen
+static Node *pruneCond(Node *node);
+//number of set!s and defines in node of slot of the frame depth levels up
+static int countWrites(Node *node, int depth, int slot);
+//number of nodes in node, or more than limit if it has more
+static int countNodes(Node *node, int limit);
+//nonzero when node refers to the global name
+static int refersTo(Node *node, Value *name);
+//replace the references in node to slot of the frame depth levels up
+static Node *substitute(Node *node, int depth, int slot, Node *replacement);
+//make references in node past the frame depth levels up one frame shorter
+static void shiftDepths(Node *node, int depth);
+//a copy of node and all its children
+static Node *copyNode(Node *node);
+//nonzero when node is a constant with the given value
+static int isConstant(Node *node, Value *value);
+
+void optimizeProgram(Node **program, int count, Frame *globalFrame){
+    Optimizer optimizer = {0};
+    optimizer.globalFrame = globalFrame;
+
+    for (int form = 0; form < count; form++) {
+        collectAssigned(&optimizer, program[form]);
+    }
+    // A procedure is only inlined into the forms after the one defining it,
+    // which run once it is bound.
+    for (int form = 0; form < count; form++) {
+        program[form] = optimizeNode(&optimizer, program[form]);
+        addInlinable(&optimizer, program[form]);
+    }
+    free(optimizer.globals);
+    free(optimizer.expanding);
+    free(optimizer.scopes);
+}
+
+static void *reserve(void *array, int count, int *capacity, size_t size) {
+    if (count < *capacity) {
+        return array;
+    }
+    *capacity = *capacity == 0 ? 16 : *capacity * 2;
+    array = realloc(array, size * *capacity);
+    if (array == NULL) {
+        printf("Error: out of memory\n");
+        texit(1);
+    }
+    return array;
+}
+
+static void collectAssigned(Optimizer *optimizer, Node *node) {
+    if (node == NULL) {
+        return;
+    }
+    if ((node->kind == DEFINE_NODE || node->kind == SET_NODE) && node->depth < 0) {
+        findGlobal(optimizer, node->value, 1)->assigned++;
+    }
+    for (int i = 0; i < node->count; i++) {
+        collectAssigned(optimizer, node->children[i]);
+    }
+}
+
+// The table is kept at most half full, so probes are short.
+static Global *findGlobal(Optimizer *optimizer, Value *name, int add) {
+    if (add && optimizer->globalCount * 2 >= optimizer->globalCapacity) {
+        Global *old = optimizer->globals;
+        int oldCapacity = optimizer->globalCapacity;
+        optimizer->globalCapacity = oldCapacity == 0 ? 256 : oldCapacity * 2;
+        optimizer->globals = calloc(optimizer->globalCapacity, sizeof(Global));
+        if (optimizer->globals == NULL) {
+            printf("Error: out of memory\n");
+            texit(1);
+        }
+        for (int i = 0; i < oldCapacity; i++) {
+            if (old[i].name != NULL) {
+                optimizer->globals[globalSlot(optimizer, old[i].name)] = old[i];
+            }
+        }
+        free(old);
+    }
+    if (optimizer->globalCapacity == 0) {
+        return NULL;
+    }
+
+    Global *global = &optimizer->globals[globalSlot(optimizer, name)];
+    if (global->name == NULL) {
+        if (!add) {
+            return NULL;
+        }
+        global->name = name;
+        optimizer->globalCount++;
+    }
+    return global;
+}
+
+// Symbols are interned, so names compare by address.
+static int globalSlot(Optimizer *optimizer, Value *name) {
+    int mask = optimizer->globalCapacity - 1;
+    int slot = ((uintptr_t)name >> 4) & mask;
+    while (optimizer->globals[slot].name != NULL && optimizer->globals[slot].name != name) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int timesAssigned(Optimizer *optimizer, Value *name) {
+    Global *global = findGlobal(optimizer, name, 0);
+    return global == NULL ? 0 : global->assigned;
+}
+
+// The define must be the only write of the name, and the procedure small,
+// not recursive and of a fixed number of parameters. Its body only refers to
+// its own frame, the frames inside it and globals, so it runs the same in a
+// frame whose parent is not the global frame.
+static void addInlinable(Optimizer *optimizer, Node *form) {
+    if (form->kind != DEFINE_NODE || form->depth >= 0
+        || form->children[0]->kind != LAMBDA_NODE) {
+        return;
+    }
+    Node *lambda = form->children[0];
+    if (typeOf(lambda->value) == SYMBOL_TYPE || timesAssigned(optimizer, form->value) != 1
+        || countNodes(lambda->children[0], INLINE_BUDGET) > INLINE_BUDGET
+        || refersTo(lambda->children[0], form->value)) {
+        return;
+    }
+    findGlobal(optimizer, form->value, 0)->inlinable = lambda;
+}
+
+// Children are optimized before their parent, so a parent sees constants
+// that only appear once its children have been folded. Let bodies are the
+// exception: the known values of the bindings go into the body first.
+static Node *optimizeNode(Optimizer *optimizer, Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    if (node->kind == LET_NODE) {
+        for (int i = 0; i < node->index; i++) {
+            node->children[i] = optimizeNode(optimizer, node->children[i]);
+        }
+        return optimizeLet(optimizer, node);
+    }
+
+    for (int i = 0; i < node->count; i++) {
+        int inner = opensFrame(node, i);
+        if (inner) {
+            optimizer->scopes = reserve(optimizer->scopes, optimizer->scopeCount,
+                                        &optimizer->scopeCapacity, sizeof(Node *));
+            optimizer->scopes[optimizer->scopeCount++] = node;
+        }
+        node->children[i] = optimizeNode(optimizer, node->children[i]);
+        if (inner) {
+            optimizer->scopeCount--;
+        }
+        if (node->kind == LETSTAR_NODE && i < node->index) {
+            propagateBinding(optimizer, node, i);
+        }
+    }
+
+    switch (node->kind) {
+        // A test that is not a boolean is left to fail when it runs.
+        case IF_NODE:
+            if (isConstant(node->children[0], TRUE_VALUE)) {
+                return node->children[1];
+            } else if (isConstant(node->children[0], FALSE_VALUE)) {
+                return node->children[2];
+            }
+            return node;
+
+        case COND_NODE:
+            return pruneCond(node);
+
+        case CALL_NODE:
+            node = foldCall(optimizer, node);
+            return node->kind == CALL_NODE ? inlineCall(optimizer, node) : node;
+
+        default:
+            return node;
+    }
+}
+
+static Node *optimizeLet(Optimizer *optimizer, Node *node) {
+    int propagated = 0;
+    for (int i = 0; i < node->index; i++) {
+        propagated += propagateBinding(optimizer, node, i);
+    }
+
+    optimizer->scopes = reserve(optimizer->scopes, optimizer->scopeCount,
+                                &optimizer->scopeCapacity, sizeof(Node *));
+    optimizer->scopes[optimizer->scopeCount++] = node;
+    for (int i = node->index; i < node->count; i++) {
+        node->children[i] = optimizeNode(optimizer, node->children[i]);
+    }
+    optimizer->scopeCount--;
+
+    if (propagated == node->index) {
+        return elideFrame(node);
+    }
+    return node;
+}
+
+// A constant binding that nothing after it writes goes into the body. So
+// does a let binding to a local variable that is already bound, as long as
+// the variable is never written, or the initializers and body are pure so
+// that nothing can write it between the binding and the reads. A let*
+// binding is a define of its slot and only reaches the bindings and body
+// after it. Returns 1 when the binding went into the body.
+static int propagateBinding(Optimizer *optimizer, Node *node, int i) {
+    Node *init = node->kind == LET_NODE ? node->children[i] : node->children[i]->children[0];
+    int slot = node->kind == LET_NODE ? i : node->children[i]->index;
+    int first = node->kind == LET_NODE ? node->index : i + 1;
+    if (init == NULL) {
+        return 0;
+    }
+
+    for (int j = first; j < node->count; j++) {
+        if (countWrites(node->children[j], 0, slot) > 0) {
+            return 0;
+        }
+    }
+
+    if (init->kind == VARIABLE_NODE && node->kind == LET_NODE) {
+        int written = 1;
+        if (!isBound(optimizer, init, &written)) {
+            return 0;
+        }
+        for (int j = 0; written && j < node->count; j++) {
+            Node *child = node->children[j];
+            if (j < node->index ? child->kind != CONSTANT_NODE && child->kind != VARIABLE_NODE
+                                : !isPure(optimizer, child)) {
+                return 0;
+            }
+        }
+    } else if (init->kind != CONSTANT_NODE) {
+        return 0;
+    }
+
+    for (int j = first; j < node->count; j++) {
+        node->children[j] = substitute(node->children[j], 0, slot, init);
+    }
+    return 1;
+}
+
+// The variable must be a parameter of a procedure or a let binding, which
+// have their values before the body can read them. written is set when
+// anything writes it.
+static int isBound(Optimizer *optimizer, Node *variable, int *written) {
+    if (variable->depth < 0 || variable->depth >= optimizer->scopeCount) {
+        return 0;
+    }
+    Node *owner = optimizer->scopes[optimizer->scopeCount - 1 - variable->depth];
+    if ((owner->kind != LAMBDA_NODE && owner->kind != LET_NODE) || variable->index >= owner->index) {
+        return 0;
+    }
+
+    int first = owner->kind == LET_NODE ? owner->index : 0;
+    *written = 0;
+    for (int j = first; j < owner->count; j++) {
+        *written += countWrites(owner->children[j], 0, variable->index);
+    }
+    return 1;
+}
+
+// Primitives never call back into the program or write its variables.
+// Procedures made inside could run later and see the variable as it is
+// then, so making one is not pure either.
+static int isPure(Optimizer *optimizer, Node *node) {
+    if (node == NULL) {
+        return 1;
+    }
+    switch (node->kind) {
+        case SET_NODE:
+        case DEFINE_NODE:
+        case LAMBDA_NODE:
+            return 0;
+
+        case CALL_NODE: {
+            Node *operator = node->children[0];
+            if (operator->kind != VARIABLE_NODE || operator->depth >= 0) {
+                return 0;
+            }
+            Value *binding = findTableBinding(operator->value, optimizer->globalFrame);
+            if (binding == NULL || typeOf(cdr(binding)) != PRIMITIVE_TYPE
+                || timesAssigned(optimizer, operator->value) > 0) {
+                return 0;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+    for (int i = 0; i < node->count; i++) {
+        if (!isPure(optimizer, node->children[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static Node *foldCall(Optimizer *optimizer, Node *node) {
+    Node *operator = node->children[0];
+    if (operator->kind != VARIABLE_NODE || operator->depth >= 0) {
+        return node;
+    }
+    Value *binding = findTableBinding(operator->value, optimizer->globalFrame);
+    if (binding == NULL || typeOf(cdr(binding)) != PRIMITIVE_TYPE
+        || timesAssigned(optimizer, operator->value) > 0) {
+        return node;
+    }
+
+    int argc = node->count - 1;
+    Value *argv[argc + 1];
+    for (int i = 0; i < argc; i++) {
+        Node *operand = node->children[i + 1];
+        if (operand == NULL || operand->kind != CONSTANT_NODE || operand->value == NULL) {
+            return node;
+        }
+        argv[i] = operand->value;
+    }
+
+    Value *result = foldPrimitive(cdr(binding), argc, argv);
+    if (result == NULL) {
+        return node;
+    }
+    return makeNode(CONSTANT_NODE, result, 0);
+}
+
+// The call becomes a let binding the parameters to the operands, with a copy
+// of the body, which is then optimized like any other let: bindings with
+// known values go into the body, and when all of them do, the frame goes
+// too. A procedure is not inlined into its own inlined body, and inlining
+// stops INLINE_DEPTH bodies deep.
+static Node *inlineCall(Optimizer *optimizer, Node *node) {
+    Node *operator = node->children[0];
+    if (operator->kind != VARIABLE_NODE || operator->depth >= 0) {
+        return node;
+    }
+    Global *global = findGlobal(optimizer, operator->value, 0);
+    Node *lambda = global == NULL ? NULL : global->inlinable;
+    for (int i = 0; lambda != NULL && i < optimizer->expandingCount; i++) {
+        if (optimizer->expanding[i] == operator->value) {
+            lambda = NULL;
+        }
+    }
+    int argc = node->count - 1;
+    if (lambda == NULL || lambda->index != argc || optimizer->expandingCount >= INLINE_DEPTH) {
+        return node;
+    }
+
+    Node *body = copyNode(lambda->children[0]);
+    Node *inlined;
+    if (argc == 0 && lambda->frameSize == 0) {
+        inlined = body;
+    } else if (argc == 0) {
+        inlined = makeNode(LETSTAR_NODE, NULL, 1);
+        inlined->frameSize = lambda->frameSize;
+        inlined->children[0] = body;
+    } else {
+        inlined = makeNode(LET_NODE, lambda->value, argc + 1);
+        inlined->index = argc;
+        inlined->frameSize = lambda->frameSize;
+        for (int i = 0; i < argc; i++) {
+            inlined->children[i] = node->children[i + 1];
+        }
+        inlined->children[argc] = body;
+    }
+
+    optimizer->expanding = reserve(optimizer->expanding, optimizer->expandingCount,
+                                   &optimizer->expandingCapacity, sizeof(Value *));
+    optimizer->expanding[optimizer->expandingCount++] = operator->value;
+    Node *result = inlined->kind == LET_NODE ? optimizeLet(optimizer, inlined)
+                                             : optimizeNode(optimizer, inlined);
+    optimizer->expandingCount--;
+    return result;
+}
+
+// Every reference to a binding has been replaced, so if the frame has no
+// other slots, the body can run in the enclosing frame instead.
+static Node *elideFrame(Node *node) {
+    int bodyCount = node->count - node->index;
+    if (node->frameSize != node->index || bodyCount == 0) {
+        return node;
+    }
+    for (int i = node->index; i < node->count; i++) {
+        shiftDepths(node->children[i], 0);
+    }
+    if (bodyCount == 1) {
+        return node->children[node->index];
+    }
+    Node *body = makeNode(BEGIN_NODE, NULL, bodyCount);
+    for (int i = 0; i < bodyCount; i++) {
+        body->children[i] = node->children[node->index + i];
+    }
+    return body;
+}
+
+// Clauses after one whose test is always true are never tried, and that
+// clause becomes the else clause. A cond left with no clauses is void; one
+// left with only an else clause is its body.
+static Node *pruneCond(Node *node) {
+    int kept = 0;
+    for (int i = 0; i < node->count; i += 2) {
+        Node *test = node->children[i];
+        if (isConstant(test, FALSE_VALUE)) {
+            continue;
+        }
+        if (isConstant(test, TRUE_VALUE)) {
+            test = NULL;
+        }
+        node->children[kept] = test;
+        node->children[kept + 1] = node->children[i + 1];
+        kept += 2;
+        if (test == NULL) {
+            break;
+        }
+    }
+    node->count = kept;
+
+    if (kept == 0) {
+        return makeNode(CONSTANT_NODE, VOID_VALUE, 0);
+    } else if (node->children[0] == NULL) {
+        return node->children[1];
+    }
+    return node;
+}
+
+static int countWrites(Node *node, int depth, int slot) {
+    if (node == NULL) {
+        return 0;
+    }
+    int writes = 0;
+    if ((node->kind == SET_NODE || node->kind == DEFINE_NODE)
+        && node->depth == depth && node->index == slot) {
+        writes++;
+    }
+    for (int i = 0; i < node->count; i++) {
+        writes += countWrites(node->children[i], depth + opensFrame(node, i), slot);
+    }
+    return writes;
+}
+
+static int countNodes(Node *node, int limit) {
+    if (node == NULL) {
+        return 0;
+    }
+    int count = 1;
+    for (int i = 0; i < node->count && count <= limit; i++) {
+        count += countNodes(node->children[i], limit);
+    }
+    return count;
+}
+
+static int refersTo(Node *node, Value *name) {
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->kind == VARIABLE_NODE && node->depth < 0 && node->value == name) {
+        return 1;
+    }
+    for (int i = 0; i < node->count; i++) {
+        if (refersTo(node->children[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A constant is shared; a variable, which is resolved from the frame of the
+// let initializer one frame out, gets a copy resolved from where it now is.
+static Node *substitute(Node *node, int depth, int slot, Node *replacement) {
+    if (node == NULL) {
+        return NULL;
+    }
+    if (node->kind == VARIABLE_NODE && node->depth == depth && node->index == slot) {
+        if (replacement->kind == CONSTANT_NODE) {
+            return replacement;
+        }
+        Node *variable = makeNode(VARIABLE_NODE, replacement->value, 0);
+        variable->depth = replacement->depth + depth + 1;
+        variable->index = replacement->index;
+        return variable;
+    }
+    for (int i = 0; i < node->count; i++) {
+        node->children[i] = substitute(node->children[i], depth + opensFrame(node, i), slot, replacement);
+    }
+    return node;
+}
+
+static void shiftDepths(Node *node, int depth) {
+    if (node == NULL) {
+        return;
+    }
+    if ((node->kind == VARIABLE_NODE || node->kind == SET_NODE) && node->depth > depth) {
+        node->depth--;
+    }
+    for (int i = 0; i < node->count; i++) {
+        shiftDepths(node->children[i], depth + opensFrame(node, i));
+    }
+}
+
+// The copy caches neither code nor binding cells; it fills its own.
+static Node *copyNode(Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    Node *copy = makeNode(node->kind, node->value, node->count);
+    copy->depth = node->depth;
+    copy->index = node->index;
+    copy->frameSize = node->frameSize;
+    for (int i = 0; i < node->count; i++) {
+        copy->children[i] = copyNode(node->children[i]);
+    }
+    return copy;
+}
+
+static int isConstant(Node *node, Value *value) {
+    return node != NULL && node->kind == CONSTANT_NODE && node->value == value;
+}
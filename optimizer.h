@@ -0,0 +1,17 @@
+#include "value.h"
+
+#ifndef _OPTIMIZER
+#define _OPTIMIZER
+
+// Rewrite the analyzed top-level forms of a whole program before any of it
+// runs. Calls of primitives on constant arguments are folded, if and cond
+// branches with constant tests are pruned, and let-bound constants that are
+// never assigned replace the references to them. Calls of small top-level
+// procedures that are defined once and not recursive are replaced by their
+// bodies, without a frame when every argument is known. A primitive is only
+// folded when no form of the program defines or sets its name. The
+// rewritten program behaves exactly like the original, error messages
+// included.
+void optimizeProgram(Node **program, int count, Frame *globalFrame);
+
+#endif
@@ -7,36 +7,106 @@
 #include "talloc.h"
 #include "tokenizer.h"
 #include "value.h"
+#include "symbol.h"
+
+//helper functions
+
+//read the datum that starts with a token of the given type, already read
+static Value *readDatum(valueType type, Value *datum);
+//read the rest of a list whose open parenthesis has been read
+static Value *readList();
+
+// Datums are built straight from the tokens as readToken() reads them, with
+// no list of tokens in between: each list is built front to back as its
+// elements are read, and 'x is read as (quote x).
+
+Value *parse() {
+    Value *program = makeNull();
+    Value *last = NULL;
+    for (Value *datum = parseNext(); datum != NULL; datum = parseNext()) {
+        Value *cell = cons(datum, makeNull());
+        if (last == NULL) {
+            program = cell;
+        } else {
+            last->c.cdr = cell;
+            gcWriteBarrier(last);
+        }
+        last = cell;
+    }
+    return program;
+}
 
-Value *addToParseTree(Value *tree, int *depth, Value* token);
+Value *parseNext() {
+    Value *datum;
+    valueType type = readToken(&datum);
+    if (type == NULL_TYPE) {
+        return NULL;
+    }
+    return readDatum(type, datum);
+}
 
-Value *parse(Value *tokens) {
+static Value *readDatum(valueType type, Value *datum) {
+    switch (type) {
+        case OPEN_TYPE:
+            return readList();
 
-    Value *tree = makeNull();
-    int depth = 0;
+        case CLOSE_TYPE:
+            printf("Syntax error: too many close parentheses\n");
+            texit(0);
+            return NULL;
+
+        case SINGLEQUOTE_TYPE: {
+            Value *quoted;
+            valueType next = readToken(&quoted);
+            if (next == NULL_TYPE || next == CLOSE_TYPE) {
+                printf("Syntax error: nothing after quote\n");
+                texit(0);
+            }
+            quoted = readDatum(next, quoted);
+            return cons(intern("quote"), cons(quoted, makeNull()));
+        }
 
-    Value *current = tokens;
-    assert(current != NULL && "Error (parse): null pointer");
+        case OPENBRACKET_TYPE:
+        case CLOSEBRACKET_TYPE:
+        case DOT_TYPE:
+            // kept in the list as tokens
+            return punctuation(type);
 
-    while (current->type != NULL_TYPE) {
-        Value *token = car(current);
-        tree = addToParseTree(tree, &depth, token);
-        current = cdr(current);
-    }
-    if (depth != 0) {
-        printf("Syntax error: not enough close parentheses\n");
-        texit(0);
+        default:
+            return datum;
     }
+}
 
-    return reverse(tree);
+static Value *readList() {
+    Value *list = makeNull();
+    Value *last = NULL;
+    while (1) {
+        Value *datum;
+        valueType type = readToken(&datum);
+        if (type == CLOSE_TYPE) {
+            return list;
+        } else if (type == NULL_TYPE) {
+            printf("Syntax error: not enough close parentheses\n");
+            texit(0);
+        }
+
+        Value *cell = cons(readDatum(type, datum), makeNull());
+        if (last == NULL) {
+            list = cell;
+        } else {
+            last->c.cdr = cell;
+            gcWriteBarrier(last);
+        }
+        last = cell;
+    }
 }
 
 void printTree(Value *tree) {
 
-    for (Value *curr = tree; curr->type == CONS_TYPE; curr = cdr(curr)) {
-        switch(car(curr)->type){
+    for (Value *curr = tree; typeOf(curr) == CONS_TYPE; curr = cdr(curr)) {
+        switch(typeOf(car(curr))){
             case INT_TYPE:
-                printf("%i", car(curr)->i);
+                printf("%li", fixnumValue(car(curr)));
                 break;
 
             case DOUBLE_TYPE:
@@ -52,7 +122,7 @@ void printTree(Value *tree) {
                 break;
 
             case BOOL_TYPE:
-                if(car(curr)->i == 0){
+                if(car(curr) == FALSE_VALUE){
                     printf("#f");
                 }else{
                     printf("#t");
@@ -82,42 +152,9 @@ void printTree(Value *tree) {
                 break;
 
         }
-        if (cdr(curr)->type != NULL_TYPE) {
+        if (!isNull(cdr(curr))) {
             printf(" ");
         }
     }
 
 }
-
-Value *addToParseTree(Value *tree, int *depth, Value* token) {
-    if (token == NULL) {
-        printf("Syntax error: Empty token");
-        texit(0);
-    }
-
-    if (token->type == OPEN_TYPE) {
-        (*depth)++;
-    }
-
-    Value *curr = tree;
-
-    if (token->type != CLOSE_TYPE) {
-        curr = cons(token, curr);
-        return curr;
-    } else {
-        Value *newTree = makeNull();
-        while (curr->type != NULL_TYPE && car(curr)->type != OPEN_TYPE) {
-                newTree = cons(car(curr), newTree);
-                curr = cdr(curr);
-        }
-        if (curr->type == NULL_TYPE) {
-            printf("Syntax error: too many close parentheses\n");
-            texit(0);
-        }
-        // Now curr is an OPEN_TYPE
-        curr = cons(newTree, cdr(curr));
-        (*depth)--;
-        return curr;
-    }
-
-}
\ No newline at end of file
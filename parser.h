@@ -3,9 +3,15 @@
 #ifndef _PARSER
 #define _PARSER
 
-// Takes a list of tokens from a Racket program, and returns a pointer to a
-// parse tree representing that program.
-Value *parse(Value *tokens);
+// Read the whole program on stdin and return the list of its top-level
+// datums. 'x is read as (quote x), here and in parseNext().
+Value *parse();
+
+// Read the next top-level datum of the program on stdin and return it, or
+// NULL at the end of the input. Tokens are read only up to the one that
+// completes the datum, so it can be run before the rest of the program has
+// even been written.
+Value *parseNext();
 
 
 // Prints the tree to the screen in a readable fashion. It should look just like
@@ -0,0 +1,83 @@
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "symbol.h"
+
+// Every symbol ever interned, in an open-addressing hash table with linear
+// probing. The table is a traced array registered as a global root, so it
+// keeps its symbols alive; it is grown whenever it becomes half full.
+static Value **table = NULL;
+static int capacity = 0;
+static int count = 0;
+
+//helper functions
+
+//FNV-1a hash of a symbol name
+static unsigned long hashName(char *name, long length);
+//find the slot holding name, or the empty slot where it belongs
+static int findSlot(Value **entries, int size, char *name, long length);
+//move every symbol into a table twice the size
+static void grow();
+
+Value *intern(char *name){
+    return internLength(name, strlen(name));
+}
+
+Value *internLength(char *name, long length){
+    if (table == NULL) {
+        capacity = 256;
+        count = 0;
+        table = (Value **)tallocArray(capacity);
+        gcAddGlobalRoot(&table);
+    }
+
+    int slot = findSlot(table, capacity, name, length);
+    if (table[slot] != NULL) {
+        return table[slot];
+    }
+
+    Value *symbol = tallocTenured(sizeof(Value), VALUE_KIND);
+    symbol->type = SYMBOL_TYPE;
+    symbol->s = tallocTenured(length + 1, RAW_KIND);
+    memcpy(symbol->s, name, length);
+    symbol->s[length] = '\0';
+
+    table[slot] = symbol;
+    gcWriteBarrier(table);
+    count++;
+    if (count * 2 > capacity) {
+        grow();
+    }
+    return symbol;
+}
+
+static unsigned long hashName(char *name, long length) {
+    unsigned long hash = 14695981039346656037UL;
+    for (char *c = name; c < name + length; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static int findSlot(Value **entries, int size, char *name, long length) {
+    int slot = (int)(hashName(name, length) & (size - 1));
+    while (entries[slot] != NULL
+           && (strncmp(entries[slot]->s, name, length) || entries[slot]->s[length] != '\0')) {
+        slot = (slot + 1) & (size - 1);
+    }
+    return slot;
+}
+
+static void grow() {
+    int newCapacity = capacity * 2;
+    Value **entries = (Value **)tallocArray(newCapacity);
+    for (int i = 0; i < capacity; i++) {
+        if (table[i] != NULL) {
+            char *name = table[i]->s;
+            entries[findSlot(entries, newCapacity, name, strlen(name))] = table[i];
+        }
+    }
+    table = entries;
+    capacity = newCapacity;
+}
@@ -0,0 +1,16 @@
+#include "value.h"
+
+#ifndef _SYMBOL
+#define _SYMBOL
+
+// Return the one SYMBOL_TYPE value with the given name, creating it the first
+// time the name is seen. Symbols with the same name are the same pointer, so
+// they can be compared with == instead of strcmp. Interned symbols live in
+// the old generation and are never moved or freed before tfree().
+Value *intern(char *name);
+
+// intern() for the name made of the length characters at name, which need
+// not be followed by a terminator.
+Value *internLength(char *name, long length);
+
+#endif
@@ -1,68 +1,682 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
 #include "value.h"
 #include "talloc.h"
 
-//helper function
+// The heap has two generations. New objects are bumped into a small nursery;
+// a minor collection copies the nursery objects that are still reachable into
+// the old generation and resets the nursery, so short-lived garbage costs
+// nothing to reclaim. The old generation is carved out of large mmap'd chunks
+// and collected by mark-sweep. Every object is preceded by a one-word header
+// recording its size, kind and collector bits, so chunks can be walked from
+// start to end. Dead old objects are threaded onto per-size free lists, and
+// chunks that hold nothing live are handed back to the kernel.
+#define CHUNK_SIZE ((size_t)2 << 20)
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define NURSERY_SIZE ((size_t)1 << 20)
+#define ALIGNMENT 8
+#define SIZE_CLASSES 64               // exact free lists for payloads up to 512 bytes
+#define INITIAL_THRESHOLD ((size_t)8 << 20)
+#define FRAME_STACK_SIZE ((size_t)256 << 20)   // reserved, touched only as used
 
-//Memory count helper function
-static int tallocCountHelper(Value *curr);
+typedef struct Chunk {
+    struct Chunk *next;
+    size_t size;        // mapped size of the chunk, header included
+    char *end;          // end of the objects bumped into this chunk
+} Chunk;
 
-static Value *head = NULL;
+typedef struct Header {
+    uint32_t size;      // payload size in bytes, header excluded
+    uint8_t kind;       // an objectKind, FREE_KIND or FORWARDED_KIND
+    uint8_t mark;
+    uint8_t remembered; // old object already in the remembered set
+} Header;
 
-// Replacement for malloc that stores the pointers allocated. It should store
-// the pointers in some kind of list; a linked list would do fine, but insert
-// here whatever code you'll need to do so; don't call functions in the
-// pre-existing linkedlist.h. Otherwise you'll end up with circular
-// dependencies, since you're going to modify the linked list to use talloc.
+#define FREE_KIND 0xff
+#define FORWARDED_KIND 0xfe
+#define HEADER(object) ((Header *)(object) - 1)
+#define IN_NURSERY(object) ((char *)(object) >= nursery && (char *)(object) < nursery + NURSERY_SIZE)
+#define IN_FRAME_STACK(object) ((char *)(object) >= frameStack && (char *)(object) < frameStack + FRAME_STACK_SIZE)
+#define STACK_FRAME_SIZE(count) (sizeof(Frame) + sizeof(Value *) * (count))
+
+//helper functions
+
+//map a new chunk able to hold at least size bytes and link it into the list
+static Chunk *newChunk(size_t size);
+//check (once) whether transparent huge pages were requested
+static int useHugePages();
+//check (once) whether the collector should run at every safepoint
+static int stressMode();
+//check (once) whether statistics should be printed by tfree()
+static int statsMode();
+//allocate an object with a header of the given kind
+static void *allocObject(size_t size, objectKind kind);
+//map the nursery and the frame stack
+static void mapYoung();
+//call visit on the address of every pointer field of the frames on the frame stack
+static void eachStackFrame(void (*visit)(void **));
+//allocate an object in the old generation
+static void *allocOld(size_t size, objectKind kind);
+//add an old object to the remembered set
+static void remember(void *object);
+//call visit on the address of every pointer field of a traced object
+static void eachField(void *object, void (*visit)(void **));
+//copy a nursery object referenced from slot into the old generation
+static void evacuate(void **slot);
+//mark an object and queue it for tracing
+static void markSlot(void **slot);
+//return dead objects to the free lists and unmap empty chunks
+static void sweep();
+//evacuate the nursery
+static void collectMinor();
+//evacuate the nursery, then mark-sweep the old generation
+static void collectMajor();
+//monotonic clock in microseconds
+static double now();
+
+static Chunk *chunks = NULL;     // every mapped old-generation chunk, most recent first
+static Chunk *current = NULL;    // chunk being bumped from
+static char *cursor = NULL;      // next free byte in the current chunk
+static char *limit = NULL;       // end of the current chunk
+static void *freeLists[SIZE_CLASSES + 1];
+
+static char *nursery = NULL;
+static char *nurseryCursor = NULL;
+
+char *frameStack = NULL;
+char *frameStackTop = NULL;
+
+static size_t bytesLive = 0;           // old bytes surviving the last major collection
+static size_t bytesSinceCollect = 0;   // old bytes promoted or allocated since then
+static size_t threshold = INITIAL_THRESHOLD;
+int gcRequested = 0;
+
+static void ***roots = NULL;     // addresses of registered C locals
+static int rootCount = 0;
+static int rootCapacity = 0;
+static void ***globals = NULL;   // addresses of registered global variables
+static int globalCount = 0;
+static int globalCapacity = 0;
+static void ****stackBases = NULL; // registered stacks of roots: their bases
+static void ****stackTops = NULL;  // and their tops
+static int stackCount = 0;
+static int stackCapacity = 0;
+static void **remembered = NULL; // old objects that may point into the nursery
+static int rememberedCount = 0;
+static int rememberedCapacity = 0;
+static void **workList = NULL;   // objects marked or promoted but not yet scanned
+static int workCount = 0;
+static int workCapacity = 0;
+
+static struct {
+    long minorCount, majorCount;
+    double minorPause, minorMaxPause, majorPause, majorMaxPause;
+    size_t nurseryBytes, promotedBytes;
+} stats;
+
+// Replacement for malloc; the memory is raw bytes the collector never looks
+// inside. It stays alive as long as a traced object points at it.
 void *talloc(size_t size){
-    //create a new null head node
-    if (head == NULL) {
-        head = (Value*)malloc(sizeof(Value));
-        head->type = NULL_TYPE;
-    }
-    
-    //create newNode to store the pointer of talloced space
-    Value *newNode = malloc(sizeof(Value));
-    newNode->type = PTR_TYPE;
-    newNode->p = malloc(size);
-
-    //cons head and newNode
-    Value *newCons = malloc(sizeof(Value));
-    newCons->type = CONS_TYPE;
-    newCons->c.car = newNode;
-    newCons->c.cdr = head;
-    
-    //move head to the front
-    head = newCons;
-
-    return newNode->p;
-}
-
-// Free all pointers allocated by talloc, as well as whatever memory you
-// allocated in lists to hold those pointers.
-void tfree(){
-    if (head == NULL) {
+    return allocObject(size, RAW_KIND);
+}
+
+// Allocate a Value the collector traces according to its type.
+Value *tallocValue(){
+    return allocObject(sizeof(Value), VALUE_KIND);
+}
+
+// Allocate a Frame of count empty slots, traced through its parent, table
+// and slots.
+Frame *tallocFrame(int count){
+    Frame *frame = allocObject(sizeof(Frame) + sizeof(Value *) * count, FRAME_KIND);
+    frame->count = count;
+    return frame;
+}
+
+// Stack frames are laid out back to back with nothing in between, so the
+// collector can walk them from the bottom by their counts.
+Frame *tallocStackFrame(int count){
+    size_t size = STACK_FRAME_SIZE(count);
+    if (nursery == NULL) {
+        mapYoung();
+    }
+    if ((size_t)(frameStack + FRAME_STACK_SIZE - frameStackTop) < size) {
+        return tallocFrame(count);
+    }
+    Frame *frame = (Frame *)frameStackTop;
+    frameStackTop += size;
+    memset(frame, 0, size);
+    frame->count = count;
+    return frame;
+}
+
+void frameStackPop(char *mark){
+    // Poison the released frames so a frame used after its release shows up
+    if (stressMode()) {
+        memset(mark, 0xdb, frameStackTop - mark);
+    }
+    frameStackTop = mark;
+}
+
+// Allocate an array of heap pointers the collector traces word by word.
+void **tallocArray(int count){
+    return allocObject(sizeof(void *) * count, ARRAY_KIND);
+}
+
+// Allocate an object straight into the old generation, where it never moves.
+void *tallocTenured(size_t size, objectKind kind){
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    // The caller fills it in without a barrier, possibly with nursery pointers
+    void *object = allocOld(size, kind);
+    if (kind != RAW_KIND) {
+        remember(object);
+    }
+    return object;
+}
+
+static void *allocObject(size_t size, objectKind kind) {
+    size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    size_t total = size + sizeof(Header);
+
+    if (nursery == NULL) {
+        mapYoung();
+    }
+
+    if ((size_t)(nursery + NURSERY_SIZE - nurseryCursor) >= total) {
+        Header *header = (Header *)nurseryCursor;
+        nurseryCursor += total;
+        stats.nurseryBytes += total;
+        header->size = (uint32_t)size;
+        header->kind = kind;
+        header->mark = 0;
+        header->remembered = 0;
+        memset(header + 1, 0, size);
+        return header + 1;
+    }
+
+    // The nursery is full (or the object is too big for it). Collection can
+    // only happen at a safepoint, so until then allocate straight into the
+    // old generation. The object may be filled with nursery pointers before
+    // the next minor collection, so it starts out remembered.
+    if (total <= NURSERY_SIZE / 4 && gcRequested == 0) {
+        gcRequested = 1;
+    }
+    void *object = allocOld(size, kind);
+    if (kind != RAW_KIND) {
+        remember(object);
+    }
+    return object;
+}
+
+// The frame stack is mapped along with the nursery, so it exists before the
+// first mark is taken.
+static void mapYoung() {
+    nursery = mmap(NULL, NURSERY_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nursery == MAP_FAILED) {
+        printf("Memory error: unable to map the nursery\n");
+        texit(1);
+    }
+    nurseryCursor = nursery;
+
+    frameStack = mmap(NULL, FRAME_STACK_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (frameStack == MAP_FAILED) {
+        printf("Memory error: unable to map the frame stack\n");
+        texit(1);
+    }
+    frameStackTop = frameStack;
+    stressMode();
+}
+
+static void *allocOld(size_t size, objectKind kind) {
+    size_t total = size + sizeof(Header);
+    Header *header = NULL;
+
+    bytesSinceCollect += total;
+    if (bytesSinceCollect >= threshold) {
+        gcRequested = 2;
+    }
+
+    if (size / ALIGNMENT <= SIZE_CLASSES && freeLists[size / ALIGNMENT] != NULL) {
+        void *object = freeLists[size / ALIGNMENT];
+        freeLists[size / ALIGNMENT] = *(void **)object;
+        header = HEADER(object);
+    } else if (total > CHUNK_SIZE / 4) {
+        Chunk *large = newChunk(total);
+        header = (Header *)((char *)large + sizeof(Chunk));
+        large->end = (char *)header + total;
+    } else {
+        if (cursor == NULL || (size_t)(limit - cursor) < total) {
+            if (current != NULL) {
+                current->end = cursor;
+            }
+            current = newChunk(CHUNK_SIZE - sizeof(Chunk));
+            cursor = (char *)current + sizeof(Chunk);
+            limit = (char *)current + current->size;
+        }
+        header = (Header *)cursor;
+        cursor += total;
+    }
+
+    header->size = (uint32_t)size;
+    header->kind = kind;
+    header->mark = 0;
+    header->remembered = 0;
+    // Recycled memory is dirty; traced objects must start out empty
+    memset(header + 1, 0, size);
+    return header + 1;
+}
+
+// Register the address of a C local holding a heap pointer, so objects only
+// referenced from the C stack survive a collection.
+void gcPushRoot(void *slot){
+    if (rootCount == rootCapacity) {
+        rootCapacity = rootCapacity == 0 ? 256 : rootCapacity * 2;
+        roots = realloc(roots, sizeof(void **) * rootCapacity);
+    }
+    roots[rootCount++] = slot;
+}
+
+// Register the address of a global holding a heap pointer. Unlike the C
+// locals above it stays a root until tfree().
+void gcAddGlobalRoot(void *slot){
+    if (globalCount == globalCapacity) {
+        globalCapacity = globalCapacity == 0 ? 16 : globalCapacity * 2;
+        globals = realloc(globals, sizeof(void **) * globalCapacity);
+    }
+    globals[globalCount++] = slot;
+}
+
+// Register a stack of roots outside the heap. Its bounds are read through
+// base and top at every collection.
+void gcAddRootStack(void *base, void *top){
+    if (stackCount == stackCapacity) {
+        stackCapacity = stackCapacity == 0 ? 4 : stackCapacity * 2;
+        stackBases = realloc(stackBases, sizeof(void ***) * stackCapacity);
+        stackTops = realloc(stackTops, sizeof(void ***) * stackCapacity);
+    }
+    stackBases[stackCount] = base;
+    stackTops[stackCount] = top;
+    stackCount++;
+}
+
+// Unregister the most recently pushed count roots.
+void gcPopRoots(int count){
+    rootCount -= count;
+}
+
+// Record that a pointer was stored into object. Old objects that may now
+// point into the nursery are remembered so the next minor collection treats
+// their fields as roots.
+void gcWriteBarrier(void *object){
+    if (object != NULL && !isImmediate(object) && !IN_NURSERY(object)
+        && !IN_FRAME_STACK(object) && !HEADER(object)->remembered) {
+        remember(object);
+    }
+}
+
+static void remember(void *object) {
+    HEADER(object)->remembered = 1;
+    if (rememberedCount == rememberedCapacity) {
+        rememberedCapacity = rememberedCapacity == 0 ? 256 : rememberedCapacity * 2;
+        remembered = realloc(remembered, sizeof(void *) * rememberedCapacity);
+    }
+    remembered[rememberedCount++] = object;
+}
+
+// Run whichever collection the allocator asked for.
+void gcCollectRequested(){
+    static int stressCount = 0;
+    if (gcRequested == 2 || (stressMode() && ++stressCount % 8 == 0)) {
+        collectMajor();
+    } else {
+        collectMinor();
+    }
+    gcRequested = stressMode() ? 1 : 0;
+}
+
+// Promote everything reachable in the nursery into the old generation.
+void gcCollectMinor(){
+    collectMinor();
+    if (!stressMode() && gcRequested == 1) {
+        gcRequested = 0;
+    }
+}
+
+// Collect both generations.
+void gcCollect(){
+    collectMajor();
+    gcRequested = stressMode() ? 1 : 0;
+}
+
+static void pushWork(void *object) {
+    if (workCount == workCapacity) {
+        workCapacity = workCapacity == 0 ? 1024 : workCapacity * 2;
+        workList = realloc(workList, sizeof(void *) * workCapacity);
+    }
+    workList[workCount++] = object;
+}
+
+static void collectMinor() {
+    if (nursery == NULL) {
+        return;
+    }
+    double start = now();
+
+    for (int i = 0; i < rootCount; i++) {
+        evacuate(roots[i]);
+    }
+    for (int i = 0; i < globalCount; i++) {
+        evacuate(globals[i]);
+    }
+    for (int i = 0; i < stackCount; i++) {
+        for (void **entry = *stackBases[i]; entry < *stackTops[i]; entry++) {
+            evacuate(entry);
+        }
+    }
+    eachStackFrame(evacuate);
+    for (int i = 0; i < rememberedCount; i++) {
+        HEADER(remembered[i])->remembered = 0;
+        eachField(remembered[i], evacuate);
+    }
+    rememberedCount = 0;
+    while (workCount > 0) {
+        eachField(workList[--workCount], evacuate);
+    }
+
+    // Poison the evacuated nursery so a missing root shows up quickly
+    if (stressMode()) {
+        memset(nursery, 0xdb, nurseryCursor - nursery);
+    }
+    nurseryCursor = nursery;
+
+    double pause = now() - start;
+    stats.minorCount++;
+    stats.minorPause += pause;
+    if (pause > stats.minorMaxPause) {
+        stats.minorMaxPause = pause;
+    }
+}
+
+static void evacuate(void **slot) {
+    void *object = *slot;
+    // immediates carry their value in the pointer and have no storage
+    if (object == NULL || isImmediate(object) || !IN_NURSERY(object)) {
         return;
     }
 
-    Value *next;
-    Value *curr = head; 
+    Header *header = HEADER(object);
+    if (header->kind == FORWARDED_KIND) {
+        *slot = *(void **)object;
+        return;
+    }
+
+    void *copy = allocOld(header->size, header->kind);
+    memcpy(copy, object, header->size);
+    stats.promotedBytes += header->size + sizeof(Header);
+    if (header->kind != RAW_KIND) {
+        pushWork(copy);
+    }
+
+    header->kind = FORWARDED_KIND;
+    *(void **)object = copy;
+    *slot = copy;
+}
 
-    while (curr->type != NULL_TYPE){
-        //curr->c.car->type must be PTR_TYPE
-        free(curr->c.car->p);
-        next = curr->c.cdr;
-        free(curr->c.car);
-        free(curr);
+static void eachField(void *object, void (*visit)(void **)) {
+    if (HEADER(object)->kind == FRAME_KIND) {
+        Frame *frame = object;
+        visit((void **)&frame->parent);
+        visit((void **)&frame->table);
+        for (int i = 0; i < frame->count; i++) {
+            visit((void **)&frame->slots[i]);
+        }
+        return;
+    }
+    if (HEADER(object)->kind == ARRAY_KIND) {
+        void **items = object;
+        for (size_t i = 0; i < HEADER(object)->size / sizeof(void *); i++) {
+            visit(&items[i]);
+        }
+        return;
+    }
+    if (HEADER(object)->kind == NODE_KIND) {
+        Node *node = object;
+        visit((void **)&node->value);
+        visit((void **)&node->bytecode);
+        visit((void **)&node->binding);
+        for (int i = 0; i < node->count; i++) {
+            visit((void **)&node->children[i]);
+        }
+        return;
+    }
+    if (HEADER(object)->kind != VALUE_KIND) {
+        return;
+    }
+
+    Value *value = object;
+    switch (value->type) {
+        case STR_TYPE:
+        case SYMBOL_TYPE:
+        case OPEN_TYPE:
+        case CLOSE_TYPE:
+        case OPENBRACKET_TYPE:
+        case CLOSEBRACKET_TYPE:
+        case DOT_TYPE:
+        case SINGLEQUOTE_TYPE:
+            visit((void **)&value->s);
+            break;
+
+        case CONS_TYPE:
+            visit((void **)&value->c.car);
+            visit((void **)&value->c.cdr);
+            break;
+
+        case BOX_TYPE:
+            visit((void **)&value->c.car);
+            break;
+
+        case CLOSURE_TYPE:
+            visit((void **)&value->closure.code);
+            visit((void **)&value->closure.frame);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void eachStackFrame(void (*visit)(void **)) {
+    char *p = frameStack;
+    while (p < frameStackTop) {
+        Frame *frame = (Frame *)p;
+        visit((void **)&frame->parent);
+        visit((void **)&frame->table);
+        for (int i = 0; i < frame->count; i++) {
+            visit((void **)&frame->slots[i]);
+        }
+        p += STACK_FRAME_SIZE(frame->count);
+    }
+}
+
+static void collectMajor() {
+    // With the nursery empty every live object is old and nothing needs to be
+    // remembered, so marking only has to follow pointers between old objects.
+    collectMinor();
+    double start = now();
+
+    for (int i = 0; i < rootCount; i++) {
+        markSlot(roots[i]);
+    }
+    for (int i = 0; i < globalCount; i++) {
+        markSlot(globals[i]);
+    }
+    for (int i = 0; i < stackCount; i++) {
+        for (void **entry = *stackBases[i]; entry < *stackTops[i]; entry++) {
+            markSlot(entry);
+        }
+    }
+    eachStackFrame(markSlot);
+    while (workCount > 0) {
+        eachField(workList[--workCount], markSlot);
+    }
+
+    sweep();
+
+    bytesSinceCollect = 0;
+    threshold = bytesLive * 2 > INITIAL_THRESHOLD ? bytesLive * 2 : INITIAL_THRESHOLD;
+
+    double pause = now() - start;
+    stats.majorCount++;
+    stats.majorPause += pause;
+    if (pause > stats.majorMaxPause) {
+        stats.majorMaxPause = pause;
+    }
+}
+
+static void markSlot(void **slot) {
+    void *object = *slot;
+    // stack frames have no header; they are all traced as roots
+    if (object == NULL || isImmediate(object) || IN_FRAME_STACK(object)
+        || HEADER(object)->mark) {
+        return;
+    }
+    HEADER(object)->mark = 1;
+    if (HEADER(object)->kind != RAW_KIND) {
+        pushWork(object);
+    }
+}
+
+static void sweep() {
+    for (int i = 0; i <= SIZE_CLASSES; i++) {
+        freeLists[i] = NULL;
+    }
+    bytesLive = 0;
+
+    Chunk **link = &chunks;
+    while (*link != NULL) {
+        Chunk *chunk = *link;
+        char *start = (char *)chunk + sizeof(Chunk);
+        char *end = chunk == current ? cursor : chunk->end;
+        size_t live = 0;
+
+        for (char *p = start; p < end; p += sizeof(Header) + ((Header *)p)->size) {
+            Header *header = (Header *)p;
+            if (header->kind != FREE_KIND && header->mark) {
+                live += sizeof(Header) + header->size;
+            }
+        }
+
+        if (live == 0 && chunk != current) {
+            *link = chunk->next;
+            munmap(chunk, chunk->size);
+            continue;
+        }
+
+        for (char *p = start; p < end; p += sizeof(Header) + ((Header *)p)->size) {
+            Header *header = (Header *)p;
+            if (header->kind != FREE_KIND && header->mark) {
+                header->mark = 0;
+                continue;
+            }
+            header->kind = FREE_KIND;
+            if (stressMode()) {
+                // Poison dead objects so a missing root shows up quickly
+                memset(header + 1, 0xdb, header->size);
+            }
+            if (header->size / ALIGNMENT <= SIZE_CLASSES) {
+                *(void **)(header + 1) = freeLists[header->size / ALIGNMENT];
+                freeLists[header->size / ALIGNMENT] = header + 1;
+            }
+        }
+
+        bytesLive += live;
+        link = &chunk->next;
+    }
+}
+
+// Print collection counts, pause times and the promotion rate to stderr.
+void gcPrintStats(){
+    fprintf(stderr, "gc: %ld minor collections, %.0f us total, %.0f us max\n",
+            stats.minorCount, stats.minorPause, stats.minorMaxPause);
+    fprintf(stderr, "gc: %ld major collections, %.0f us total, %.0f us max\n",
+            stats.majorCount, stats.majorPause, stats.majorMaxPause);
+    fprintf(stderr, "gc: %zu bytes allocated in the nursery, %zu promoted (%.2f%%)\n",
+            stats.nurseryBytes, stats.promotedBytes,
+            stats.nurseryBytes == 0 ? 0.0 : 100.0 * stats.promotedBytes / stats.nurseryBytes);
+}
+
+// Free all memory allocated by talloc by unmapping every chunk and the
+// nursery. Set TALLOC_GC_STATS=1 to have the collector statistics printed
+// first.
+void tfree(){
+    if (statsMode()) {
+        gcPrintStats();
+    }
+
+    Chunk *curr = chunks;
+    while (curr != NULL) {
+        Chunk *next = curr->next;
+        munmap(curr, curr->size);
         curr = next;
     }
+    if (nursery != NULL) {
+        munmap(nursery, NURSERY_SIZE);
+        munmap(frameStack, FRAME_STACK_SIZE);
+    }
 
-    free(curr); //free the final nullValue
-    head = NULL;
+    chunks = NULL;
+    current = NULL;
+    cursor = NULL;
+    limit = NULL;
+    nursery = NULL;
+    nurseryCursor = NULL;
+    frameStack = NULL;
+    frameStackTop = NULL;
+    for (int i = 0; i <= SIZE_CLASSES; i++) {
+        freeLists[i] = NULL;
+    }
+    bytesLive = 0;
+    bytesSinceCollect = 0;
+    threshold = INITIAL_THRESHOLD;
+    gcRequested = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    free(roots);
+    roots = NULL;
+    rootCount = rootCapacity = 0;
+    for (int i = 0; i < globalCount; i++) {
+        *globals[i] = NULL;
+    }
+    free(globals);
+    globals = NULL;
+    globalCount = globalCapacity = 0;
+    free(stackBases);
+    free(stackTops);
+    stackBases = NULL;
+    stackTops = NULL;
+    stackCount = stackCapacity = 0;
+    free(remembered);
+    remembered = NULL;
+    rememberedCount = rememberedCapacity = 0;
+    free(workList);
+    workList = NULL;
+    workCount = workCapacity = 0;
 }
 
-// 
+//
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
@@ -72,20 +686,85 @@ void texit(int status){
 }
 
 int tallocMemoryCount(){
-    return tallocCountHelper(head);
+    size_t young = nursery == NULL ? 0 : (size_t)(nurseryCursor - nursery);
+    return (int)(bytesLive + bytesSinceCollect + young);
 }
 
-static int tallocCountHelper(Value *curr) {
-    if (curr == NULL) {
-        return 0;
-    }
+static Chunk *newChunk(size_t size) {
+    size_t mapSize = size + sizeof(Chunk);
+    void *memory;
 
-    if (curr->type == NULL_TYPE) {
-        return sizeof(*curr);
+    if (useHugePages()) {
+        // Over-map by one huge page so the chunk can be aligned to a huge page
+        // boundary, then trim the slack on both sides.
+        mapSize = (mapSize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        char *raw = mmap(NULL, mapSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            printf("Memory error: unable to map a new chunk\n");
+            texit(1);
+        }
+        char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        if (aligned > raw) {
+            munmap(raw, aligned - raw);
+        }
+        munmap(aligned + mapSize, HUGE_PAGE_SIZE - (aligned - raw));
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, mapSize, MADV_HUGEPAGE);
+#endif
+        memory = aligned;
+    } else {
+        memory = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            printf("Memory error: unable to map a new chunk\n");
+            texit(1);
+        }
     }
 
-    int currSize = sizeof(*curr)+sizeof(*(curr->c.car))+sizeof(*(curr->c.car->p));
+    Chunk *chunk = memory;
+    chunk->size = mapSize;
+    chunk->end = (char *)chunk + sizeof(Chunk);
+    chunk->next = chunks;
+    chunks = chunk;
+    return chunk;
+}
+
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+// Huge pages are opt-in: set TALLOC_HUGEPAGES=1 in the environment.
+static int useHugePages() {
+    static int cached = -1;
+    if (cached == -1) {
+        char *setting = getenv("TALLOC_HUGEPAGES");
+        cached = setting != NULL && setting[0] != '\0' && setting[0] != '0';
+    }
+    return cached;
+}
 
-    return currSize + tallocCountHelper(curr->c.cdr);
+// Collector stress testing is opt-in: set TALLOC_GC_STRESS=1.
+static int stressMode() {
+    static int cached = -1;
+    if (cached == -1) {
+        char *setting = getenv("TALLOC_GC_STRESS");
+        cached = setting != NULL && setting[0] != '\0' && setting[0] != '0';
+        if (cached) {
+            gcRequested = 1;
+        }
+    }
+    return cached;
 }
 
+// Collector statistics are opt-in: set TALLOC_GC_STATS=1.
+static int statsMode() {
+    static int cached = -1;
+    if (cached == -1) {
+        char *setting = getenv("TALLOC_GC_STATS");
+        cached = setting != NULL && setting[0] != '\0' && setting[0] != '0';
+    }
+    return cached;
+}
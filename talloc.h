@@ -4,15 +4,118 @@
 #ifndef _TALLOC
 #define _TALLOC
 
-// Replacement for malloc that stores the pointers allocated. It should store
-// the pointers in some kind of list; a linked list would do fine, but insert
-// here whatever code you'll need to do so; don't call functions in the
-// pre-existing linkedlist.h. Otherwise you'll end up with circular
-// dependencies, since you're going to modify the linked list to use talloc.
+// Kinds of objects on the collected heap. The collector traces VALUE_KIND,
+// FRAME_KIND and NODE_KIND objects according to their layout and every word
+// of an ARRAY_KIND object; RAW_KIND memory (strings) is never looked inside.
+typedef enum {
+    RAW_KIND, VALUE_KIND, FRAME_KIND, ARRAY_KIND, NODE_KIND
+} objectKind;
+
+// Replacement for malloc. New memory is bumped out of a nursery; objects still
+// reachable at a minor collection are copied into the old generation, which
+// is made of large mmap'd chunks and collected by mark-sweep. Set
+// TALLOC_HUGEPAGES=1 to back old chunks with transparent huge pages. Don't
+// call functions in linkedlist.h from here, since the linked list uses talloc.
 void *talloc(size_t size);
 
-// Free all pointers allocated by talloc, as well as whatever memory you
-// allocated in lists to hold those pointers.
+// Allocate a Value that the collector traces according to its type.
+Value *tallocValue();
+
+// Allocate a Frame with count slots, all NULL, that the collector traces
+// through its parent, table and slots.
+Frame *tallocFrame(int count);
+
+// Frames that cannot outlive the code that made them are bumped off a frame
+// stack instead of the heap and given back in bulk by frameStackRelease. They
+// carry no header, never move, and need no write barrier; the collector
+// treats every frame below the top as a root. Frames here may point at each
+// other and into the heap, but nothing on the heap may point at them.
+extern char *frameStack;
+extern char *frameStackTop;
+
+// Allocate a Frame with count slots, all NULL, on the frame stack, or on the
+// heap if the frame stack is full.
+Frame *tallocStackFrame(int count);
+
+// The current top of the frame stack, to release back to later.
+ALWAYS_INLINE void *frameStackMark() {
+    return frameStackTop;
+}
+
+// Drop every frame allocated on the frame stack since mark was taken. Used by
+// frameStackRelease; do not call it directly.
+void frameStackPop(char *mark);
+
+// Release the frame stack back to mark. A mark above the top, or a frame that
+// is not on the frame stack, releases nothing.
+ALWAYS_INLINE void frameStackRelease(void *mark) {
+    if ((char *)mark < frameStackTop && (char *)mark >= frameStack) {
+        frameStackPop(mark);
+    }
+}
+
+// Allocate an array of count heap pointers, all NULL, that the collector
+// traces.
+void **tallocArray(int count);
+
+// Allocate an object of the given kind directly in the old generation. Use it
+// for data that lives as long as the program, such as interned symbols: it is
+// never copied, so its address can be kept in places the collector does not
+// know about as long as something else keeps it alive.
+void *tallocTenured(size_t size, objectKind kind);
+
+// Register the address of a global variable holding a heap pointer as a
+// permanent root. tfree() sets every registered global back to NULL and
+// forgets it.
+void gcAddGlobalRoot(void *slot);
+
+// Register the address of a C local (a Value ** or Frame **) as a root. Any
+// heap pointer held in a C local across a safepoint must be registered: the
+// object may be reclaimed otherwise, and a minor collection moves nursery
+// objects and updates only the registered copy of the pointer.
+void gcPushRoot(void *slot);
+
+// Register a stack of heap pointers that lives outside the traced heap, such
+// as the operand stack of the bytecode machine. The entries from *base up to,
+// not including, *top are roots at every collection. Both are read again at
+// each collection, so the owner may move the stack, and it only has to update
+// *top before a safepoint. tfree() forgets every registered stack.
+void gcAddRootStack(void *base, void *top);
+
+// Unregister the most recently pushed count roots.
+void gcPopRoots(int count);
+
+// Call after storing a pointer into a field of an object that may have been
+// allocated before the last safepoint (and so may already be old). Objects
+// allocated since the last safepoint need no barrier.
+void gcWriteBarrier(void *object);
+
+// Nonzero when the allocator wants a collection: 1 for minor, 2 for major.
+extern int gcRequested;
+
+// Run the collection the allocator asked for.
+void gcCollectRequested();
+
+// Collect garbage if the nursery is full or the old generation has grown past
+// its threshold. Allocation never collects by itself; only safepoints do.
+// TALLOC_GC_STRESS=1 collects at every safepoint.
+static inline void gcSafepoint() {
+    if (gcRequested) {
+        gcCollectRequested();
+    }
+}
+
+// Promote everything reachable in the nursery into the old generation.
+void gcCollectMinor();
+
+// Collect both generations unconditionally.
+void gcCollect();
+
+// Print collection counts, pause times and the nursery promotion rate to
+// stderr. tfree() does this itself when TALLOC_GC_STATS=1.
+void gcPrintStats();
+
+// Free all memory allocated by talloc by unmapping every chunk.
 void tfree();
 
 // Replacement for the C function "exit", that consists of two lines: it calls
@@ -20,5 +123,9 @@ void tfree();
 // you can exit your program, and all memory is automatically cleaned up.
 void texit(int status);
 
+// Number of bytes on the heap: what survived the last collection plus what
+// has been allocated since.
+int tallocMemoryCount();
+
 #endif
 
@@ -0,0 +1,9 @@
+(define x 1)
+(define get-x (lambda () x))
+(get-x)
+(define x 2)
+(get-x)
+(set! x 3)
+(get-x)
+(define car (lambda (l) 42))
+(car (cons 1 2))
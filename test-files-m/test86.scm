@@ -0,0 +1,18 @@
+;; Loops written as tail recursion run in constant stack space
+(define (count-down n)
+  (if (= n 0)
+      (quote done)
+      (count-down (- n 1))))
+(count-down 200000)
+
+(define (sum-to n acc)
+  (cond ((= n 0) acc)
+        (else (let ((next (- n 1)))
+                (sum-to next (+ acc n))))))
+(sum-to 200000 0)
+
+(define (my-even? n)
+  (or (= n 0) (my-odd? (- n 1))))
+(define (my-odd? n)
+  (and (> n 0) (my-even? (- n 1))))
+(my-even? 200001)
@@ -0,0 +1,15 @@
+;; Deep non-tail recursion is limited by the heap, not the C stack
+(define (sum n)
+  (if (= n 0)
+      0
+      (+ n (sum (- n 1)))))
+(sum 100000)
+
+(define (build n)
+  (if (= n 0)
+      (quote ())
+      (cons n (build (- n 1)))))
+(define (len lst)
+  (cond ((null? lst) 0)
+        (else (+ 1 (len (cdr lst))))))
+(len (build 100000))
@@ -0,0 +1,18 @@
+;; Two-operand arithmetic on fixnums, mixed with doubles, and with the
+;; primitive shadowed by a user definition
+(define x 20)
+(+ x 22)
+(- x 25)
+(* x 3)
+(< x 21)
+(> x 21)
+(= x 20)
+(+ x 0.5)
+(< x 20.5)
+(+ (* x x) (- x 1))
+(define (shadow - a b) (- a b))
+(shadow (lambda (a b) (quote shadowed)) 1 2)
+(define * (lambda (a b) (+ a b)))
+(* 6 7)
+(define < (lambda (a b) (> a b)))
+(< 1 2)
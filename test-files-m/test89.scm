@@ -0,0 +1,10 @@
+(define f (lambda () (g 1)))
+(define g (lambda (x) x))
+(f)
+(define g (lambda (x) (+ x 100)))
+(f)
+(set! g (lambda (x) (* x 3)))
+(f)
+(define h (lambda () undefined-yet))
+(define undefined-yet 5)
+(h)
@@ -0,0 +1,27 @@
+(define seconds-per-day (* 60 60 24))
+seconds-per-day
+(if #t 1 2)
+(if #f 1 (+ 2.5 1))
+(cond (#f 1) ((< 1 2) 2) (else 3))
+(cond (#f 1))
+(cond (#f 1) (else (- 10)))
+(let ((h 60) (m 60)) (* h m))
+(let* ((a 2) (b (* a 3)) (a 10)) (+ a b))
+(let ((x 1)) (set! x 5) x)
+(let ((x 1)) (define x 7) x)
+(let ((x 1)) ((lambda () x)))
+(let ((k 3)) (let ((f (lambda (y) (* k y)))) (f 4)))
+(define g (lambda () (modulo 7 2)))
+(g)
+(car (quote (1 2 3)))
+(null? (quote ()))
+(/ 6 3)
+(/ 1 2)
+(= 1 1.0)
+(define maybe (lambda () (/ 1 0)))
+(define twice (lambda (x) (* 2 x)))
+(twice 21)
+(define twice 3)
+(define - (lambda (a b) (+ a b)))
+(- 5 3)
+(if 1 2 3)
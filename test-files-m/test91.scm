@@ -0,0 +1,35 @@
+(define less-than-or-equal (lambda (x y) (if (> x y) #f #t)))
+(define square (lambda (x) (* x x)))
+(define add3 (lambda (a b c) (+ a b c)))
+(define const (lambda () 42))
+(define with-local (lambda (n) (let ((d (* n 2))) (+ d 1))))
+(define maker (lambda (k) (lambda (y) (+ k y))))
+(define count 0)
+(define bump (lambda () (set! count (+ count 1))))
+(define pick (lambda (a b) a))
+(define use-first (lambda (f) (f 1 2)))
+(define f (lambda (k) (begin (less-than-or-equal k 0))))
+(f 5)
+(f -1)
+(square 7)
+(let ((z 3)) (square (+ z 1)))
+(add3 1 2 3)
+(const)
+(with-local 5)
+((maker 10) 5)
+(bump)
+(bump)
+count
+(define g (lambda (n) (let ((m n)) (begin (set! n 100) (pick m n)))))
+(g 7)
+(define h (lambda (n) (pick n (begin (set! n 9) n))))
+(h 1)
+(use-first pick)
+(define loop (lambda (i acc) (if (less-than-or-equal i 0) acc (loop (- i 1) (+ acc (square i))))))
+(loop 100 0)
+(define later (lambda (x) (helper x)))
+(define helper (lambda (x) (* 3 x)))
+(later 4)
+(define r (lambda (n) (if (= n 0) 0 (r (- n 1)))))
+(r 10)
+(pick 1)
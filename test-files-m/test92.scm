@@ -0,0 +1,44 @@
+(define make-counter
+  (lambda ()
+    (let ((n 0))
+      (lambda () (begin (set! n (+ n 1)) n)))))
+(define c1 (make-counter))
+(define c2 (make-counter))
+(c1)
+(c1)
+(c2)
+(define make-account
+  (lambda (balance)
+    (lambda (amount)
+      (begin (set! balance (- balance amount)) balance))))
+(define acc (make-account 100))
+(acc 10)
+(acc 20)
+(define f
+  (lambda (n)
+    (begin
+      (define even? (lambda (k) (if (= k 0) #t (odd? (- k 1)))))
+      (define odd? (lambda (k) (if (= k 0) #f (even? (- k 1)))))
+      (even? n))))
+(f 10)
+(f 7)
+(letrec ((ev (lambda (k) (if (= k 0) #t (od (- k 1))))) (od (lambda (k) (if (= k 0) #f (ev (- k 1)))))) (ev 11))
+(define adder (lambda (a) (lambda (b) (lambda (c) (+ a b c)))))
+(((adder 1) 2) 3)
+(define shared
+  (lambda (x)
+    (let ((get (lambda () x)) (put (lambda (v) (set! x v))))
+      (begin (put 42) (get)))))
+(shared 1)
+(define before
+  (lambda (x)
+    (let ((old (lambda () x)))
+      (begin (set! x 5) (old)))))
+(before 1)
+(let ((y 3)) (let ((g (lambda () y))) (begin (set! y 4) (g))))
+(define deep (lambda (a) (let* ((b (+ a 1)) (c (+ b 1))) (lambda () (let ((d 10)) (lambda () (+ a b c d)))))))
+(((deep 1)))
+(define rest (lambda args (lambda () args)))
+((rest 1 2 3))
+(define unbound-capture (lambda () (begin (define g (lambda () h)) (define h (g)) h)))
+(unbound-capture)
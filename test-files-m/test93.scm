@@ -0,0 +1,32 @@
+;; Frames are released when their procedure returns or tail calls; closures
+;; made in them must keep what they captured
+(define collect
+  (lambda (n acc)
+    (let ((k (* n n)))
+      (if (= n 0)
+          acc
+          (collect (- n 1) (cons (lambda () k) acc))))))
+(define run
+  (lambda (thunks)
+    (if (null? thunks)
+        (quote ())
+        (cons ((car thunks)) (run (cdr thunks))))))
+(run (collect 5 (quote ())))
+(define boxes
+  (lambda (n)
+    (let ((total 0))
+      (let ((add (lambda (x) (set! total (+ total x)))))
+        (begin (add n) (add (* 2 n)) (lambda () total))))))
+((boxes 7))
+(define count-down
+  (lambda (n)
+    (let* ((a n) (b (- a 1)))
+      (if (= a 0) (quote done) (count-down b)))))
+(count-down 100000)
+(define nested
+  (lambda (n)
+    (if (= n 0)
+        0
+        (let ((here n))
+          (+ (let ((inner (nested (- n 1)))) inner) here)))))
+(nested 1000)
@@ -0,0 +1,49 @@
+;; Procedures called often enough to be compiled to machine code behave the
+;; same as before
+(define fib
+  (lambda (n)
+    (if (< n 2)
+        n
+        (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 20)
+(define classify
+  (lambda (n)
+    (cond ((< n 0) (quote negative))
+          ((= n 0) (quote zero))
+          ((and (> n 0) (< n 10)) (quote small))
+          (else (let* ((big (> n 1000)) (word (if big (quote huge) (quote large)))) word)))))
+(define classify-all
+  (lambda (n acc)
+    (if (= n -3)
+        acc
+        (classify-all (- n 1) (cons (classify (* n n n)) acc)))))
+(classify-all 12 (quote ()))
+(define make-adder
+  (lambda (n)
+    (let ((total n))
+      (lambda (x) (begin (set! total (+ total x)) total)))))
+(define sum-adders
+  (lambda (n acc)
+    (if (= n 0)
+        acc
+        (sum-adders (- n 1) (+ acc ((make-adder n) n))))))
+(sum-adders 500 0)
+(define big
+  (lambda (n)
+    (if (= n 0)
+        1
+        (* 2 (big (- n 1))))))
+(big 62)
+(+ (big 61) (big 61))
+(define halves
+  (lambda (x n)
+    (if (= n 0)
+        x
+        (halves (/ x 2) (- n 1)))))
+(halves 1000 3)
+(define deep
+  (lambda (n)
+    (if (= n 0)
+        0
+        (+ 1 (deep (- n 1))))))
+(deep 5000)
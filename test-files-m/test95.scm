@@ -0,0 +1,9 @@
+   ; leading comment
+
+  (define x 5)
+; between forms
+(+ x 1) ; trailing
+'sym
+(if (> x 2)
+    (quote big)
+    (quote small))
@@ -0,0 +1,10 @@
+; quotes inside forms are read as (quote datum)
+(define letters '(a b c))
+(car letters)
+(cdr letters)
+(cons 'z letters)
+(if (null? '()) 'empty 'full)
+(define (tag x) (cons 'tagged x))
+(tag '(1 2))
+''nested
+'(a 'b)
@@ -0,0 +1,14 @@
+; arithmetic on fixnums stays exact until the result no longer fits
+(- 9007199254740993 0 0)
+(* 123456789 123456789 3)
+(* (* 123456789 123456789) 3)
+(+ 4611686018427387903 1 -1)
+(- -4611686018427387904 1 -1)
+(+ 4611686018427387903 1)
+(- -4611686018427387904 1)
+(- -4611686018427387904)
+(* 3037000500 3037000500 1)
+(* 3037000500 3037000500)
+(+ 1 2.5 3)
+(/ -4611686018427387904 -1)
+(/ -4611686018427387904 2)
@@ -0,0 +1,7 @@
+; integer literals too big for a fixnum are read as doubles
+4611686018427387903
+-4611686018427387904
+4611686018427387904
+99999999999999999999
+-99999999999999999999
+(+ 99999999999999999999 1)
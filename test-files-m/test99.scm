@@ -0,0 +1,10 @@
+; comparisons of fixnums past 2^53 are exact, including the ones the
+; optimizer works out ahead of time
+(= 9007199254740993 9007199254740992)
+(< 9007199254740992 9007199254740993 9007199254740994)
+(> 9007199254740994 9007199254740993 9007199254740992)
+(= 9007199254740993 9007199254740993 9007199254740993)
+(let ((big 9007199254740993))
+  (if (= big 9007199254740992) 'rounded 'exact))
+(define (above-limit? n) (> n 9007199254740992))
+(above-limit? 9007199254740993)
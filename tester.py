@@ -13,7 +13,7 @@ def get_student_output(executable_command, test_path) -> str:
     try:
         with open(test_path, 'r') as input_file:
             student_process = subprocess.run(
-                executable_command,
+                executable_command.split(),
                 stdin=input_file,
                 stderr=subprocess.STDOUT,
                 stdout=subprocess.PIPE,
@@ -26,6 +26,24 @@ def get_student_output(executable_command, test_path) -> str:
         return "Timed out"
 
 
+def get_program_output(command, timeout=10) -> str:
+    '''Runs a command that takes its program from its arguments rather than
+    from stdin.'''
+    try:
+        process = subprocess.run(
+            command,
+            stdin=subprocess.DEVNULL,
+            stderr=subprocess.STDOUT,
+            stdout=subprocess.PIPE,
+            timeout=timeout)
+        if (process.returncode == -signal.SIGSEGV):
+            return "Segmentation fault"
+        else:
+            return process.stdout.decode('utf-8')
+    except subprocess.TimeoutExpired:
+        return "Timed out"
+
+
 def get_correct_output(test_path) -> str:
     '''Gets correct output.'''
     with open(test_path, 'r') as correct_output:
@@ -150,14 +168,13 @@ def buildCode() -> int:
     return return_code
 
 
-def runIt(test_dir, valgrind=True) -> None:
+def runIt(test_dir, valgrind=True, executable_command="./interpreter") -> None:
 
     returncode = buildCode()
     if returncode != 0:
         return returncode
 
     error_encountered = False
-    executable_command = "./interpreter"
 
     test_names = [test_name.split('.')[0]
                   for test_name in sorted(os.listdir(test_dir))
@@ -199,3 +216,41 @@ def runIt(test_dir, valgrind=True) -> None:
                 print('---VALGRIND NO ERROR---')
 
     return error_encountered
+
+
+def compareIt(test_dir, get_outputs) -> bool:
+    '''Builds, then checks every output get_outputs(test_input_path) returns
+    for each test, as a list of (name, output) pairs, against the correct
+    output.'''
+
+    returncode = buildCode()
+    if returncode != 0:
+        return returncode
+
+    error_encountered = False
+
+    test_names = [test_name.split('.')[0]
+                  for test_name in sorted(os.listdir(test_dir))
+                  if test_name.split('.')[1] == 'scm']
+
+    for test_name in test_names:
+        print('------Test', test_name, '------')
+
+        test_input_path = os.path.join(test_dir, test_name + ".scm")
+        test_output_path = os.path.join(test_dir, test_name + ".output")
+        correct_output = get_correct_output(test_output_path)
+        correct_output = clean_output(correct_output)
+
+        for run_name, student_output in get_outputs(test_input_path):
+            student_output = clean_output(student_output)
+            if student_output != correct_output:
+                error_encountered = True
+                print("---OUTPUT INCORRECT (" + run_name + ")---")
+                print('Correct output:')
+                print(correct_output)
+                print('Student output:')
+                print(student_output)
+            else:
+                print("---OUTPUT CORRECT (" + run_name + ")---")
+
+    return error_encountered
@@ -1,322 +1,574 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "value.h"
 #include "talloc.h"
 #include "linkedlist.h"
 #include "tokenizer.h"
+#include "symbol.h"
 
 //helper functions
 
-//check if the input string is a integer
-int isuinteger(char *str);
-//check if the input string is a decimal
-int isudecimal(char *str);
+//map stdin if it is a regular file, or else set up the read buffer
+static void openInput();
+//read more input, keeping the bytes from *keep (or pos) on; 0 at the end
+static int fill(char **keep);
+//make sure count bytes from pos on are in the buffer; 0 at the end
+static int need(char **keep, long count);
+//the number or symbol made of the length characters at text
+static Value *readAtom(char *text, long length);
+//scanning kernels; see scan
+static char *scanScalar(char *from, char *to, int kind);
+#if defined(__x86_64__)
+static char *scanSSE2(char *from, char *to, int kind);
+static char *scanAVX2(char *from, char *to, int kind);
+#endif
 //check if the input string is a symbol
-int issymbol(char *str);
+int issymbol(char *str, long length);
 //check if the input char is an initial
 int isinitial(char chr);
 //check if the input char is a subsequent
 int issubsequent(char chr);
 
 
+// Tokens read so far, for the check on a leading dot.
+static int totalToken = 0;
+
+// The input is scanned in place: the whole of stdin mapped when it is a
+// regular file, or else a buffer refilled a block at a time with read().
+// The bytes from pos up to end have not been scanned yet. A token being
+// scanned when the buffer runs out is moved to its front first, and the
+// buffer grows when a token fills it, so every token is contiguous.
+#define BLOCK_SIZE 65536
+static char *buffer = NULL;
+static long capacity = 0;
+static char *pos = NULL;
+static char *end = NULL;
+static int mapped = 0;
+static int atEnd = 0;
+
+// Classes of every byte, in the C locale.
+#define SPACE 1
+#define DELIMITER 2  // ends a number or symbol
+#define INITIAL 4
+#define SUBSEQUENT 8
+#define INITIALS (INITIAL | SUBSEQUENT)
+static const unsigned char charClass[256] = {
+    [' '] = SPACE | DELIMITER, ['\t'] = SPACE | DELIMITER, ['\n'] = SPACE | DELIMITER,
+    ['\v'] = SPACE | DELIMITER, ['\f'] = SPACE | DELIMITER, ['\r'] = SPACE | DELIMITER,
+    ['#'] = DELIMITER, [')'] = DELIMITER, [']'] = DELIMITER,
+    ['a' ... 'z'] = INITIALS, ['A' ... 'Z'] = INITIALS,
+    ['!'] = INITIALS, ['$'] = INITIALS, ['%'] = INITIALS, ['&'] = INITIALS,
+    ['*'] = INITIALS, ['/'] = INITIALS, [':'] = INITIALS, ['<'] = INITIALS,
+    ['='] = INITIALS, ['>'] = INITIALS, ['?'] = INITIALS, ['~'] = INITIALS,
+    ['_'] = INITIALS, ['^'] = INITIALS,
+    ['0' ... '9'] = SUBSEQUENT, ['.'] = SUBSEQUENT, ['+'] = SUBSEQUENT, ['-'] = SUBSEQUENT,
+};
+
+// What scan looks for, from its first argument on: the first byte that is
+// not whitespace, the end of a comment line, a '"' or '\\' in a string, or
+// the end of a number or symbol. It returns its second argument if there is
+// none. openInput() picks the widest kernel the processor has; setting
+// TOKENIZER_SCALAR in the environment keeps to the scalar one.
+#define SKIP_SPACE 0
+#define FIND_LINE_END 1
+#define FIND_STRING_END 2
+#define FIND_DELIMITER 3
+static char *(*scan)(char *from, char *to, int kind) = scanScalar;
+
+// Powers of ten a double holds exactly, for readAtom().
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
 // Read all of the input from stdin, and return a linked list consisting of the
 // tokens.
 Value *tokenize(){
-    char charRead;
     Value *list = makeNull();
-    charRead = (char)fgetc(stdin);
-    char buffer[300]; 
-    int totalToken = 0;
+    for (Value *token = nextToken(); token != NULL; token = nextToken()) {
+        list = cons(token, list);
+    }
 
-    while (charRead != EOF) {
+    Value *revList = reverse(list);
+    return revList;
+}
 
-        if (charRead == '.') {
-            
-            charRead = fgetc(stdin);
-            if (totalToken == 0 || charRead == EOF) {
-                printf("Syntax error: untokenizeable (unvalid . position)\n");
-                texit(0);
+// Punctuation comes back as a value holding its text, as it always has.
+Value *nextToken(){
+    Value *datum;
+    valueType type = readToken(&datum);
+    if (type == NULL_TYPE) {
+        return NULL;
+    } else if (type == OPEN_TYPE || type == CLOSE_TYPE || type == OPENBRACKET_TYPE
+               || type == CLOSEBRACKET_TYPE || type == DOT_TYPE || type == SINGLEQUOTE_TYPE) {
+        return punctuation(type);
+    }
+    return datum;
+}
 
-            } else if (isspace(charRead)) {
-                Value *openNode = talloc(sizeof(Value));
-                openNode->type = DOT_TYPE;
-                openNode->s = talloc(sizeof(char)*2);
-                strcpy(openNode->s, ".");
-                list = cons(openNode, list);
-                
-            } else {
-                // before: .9432; after: charRead = 9, '.' is lost, 432 remains
+// Whitespace and comments before the token are skipped, and nothing after
+// it is read except what is already buffered, so a reader can act on a
+// token as soon as it has been typed. Runs of whitespace, comments, strings
+// and atoms are each found with one call to scan.
+valueType readToken(Value **datum){
+    if (pos == NULL) {
+        openInput();
+    }
 
-                //unget will insert number after current position
-                ungetc(charRead, stdin); //restore the number at current position, 9432 remains
-                charRead = '.'; //set previous char to be '.'
+    //strip all space and comments
+    while (1) {
+        pos = scan(pos, end, SKIP_SPACE);
+        if (pos < end && *pos == ';') {  // comment case
+            while (1) {
+                pos = scan(pos, end, FIND_LINE_END);
+                if (pos < end || !fill(NULL)) {
+                    break;
+                }
             }
+            continue;
         }
+        if (pos < end) {
+            break;
+        }
+        if (!fill(NULL)) {
+            return NULL_TYPE;
+        }
+    }
+    totalToken++;
 
-        if (charRead == '(') {
-            //open parenthesis
-            Value *openNode = talloc(sizeof(Value));
-            openNode->type = OPEN_TYPE;
-            openNode->s = talloc(sizeof(char)*2);
-            strcpy(openNode->s,"(");
-            list = cons(openNode, list);
-            
-        } else if (charRead == ')') {
-            //close parenthesis
-            Value *closeNode = talloc(sizeof(Value));
-            closeNode->type = CLOSE_TYPE;
-            closeNode->s = talloc(2);
-            strcpy(closeNode->s,")");
-            list = cons(closeNode, list);
-
-        } else if (charRead == '[') {
-            //open bracket
-            Value *closeNode = talloc(sizeof(Value));
-            closeNode->type = OPENBRACKET_TYPE;
-            closeNode->s = talloc(2);
-            strcpy(closeNode->s,"[");
-            list = cons(closeNode, list);
-
-        } else if (charRead == ']') {
-            //close bracket
-            Value *closeNode = talloc(sizeof(Value));
-            closeNode->type = CLOSEBRACKET_TYPE;
-            closeNode->s = talloc(2);
-            strcpy(closeNode->s,"]");
-            list = cons(closeNode, list);
-
-        } else if (charRead == '#') {
-            //test whether the token is #t or #f
-            charRead = (char)fgetc(stdin);
-            int boolValue;
-            if (charRead == 't') {
-                boolValue = 1;
-            } else if (charRead == 'f') {
-                boolValue = 0;
-            } else {
-                //error message
-                printf("Syntax error: untokenizeable (unvalid char after #)\n");
-                texit(0);
-            }
-            //cons newNode
-            Value *newNode = talloc(sizeof(Value));
-            newNode->type = BOOL_TYPE;
-            newNode->i = boolValue;
-            list = cons(newNode, list);
-
-        } else if (charRead == '"'){  // string type
-            memset((void*)buffer, '\0', sizeof(char)*300);
-            charRead = (char)fgetc(stdin);
+    char *text = pos;
+    char charRead = *pos++;
+    if (charRead == '.') {
 
-            while (charRead != '"') {
+        if (totalToken == 1 || !need(&text, 1)) {
+            printf("Syntax error: untokenizeable (unvalid . position)\n");
+            texit(0);
 
-                if (strlen(buffer) >= 300) {
-                    printf("Memory error: maximum string length reached\n");
-                    texit(0);
-                }
+        } else if (charClass[(unsigned char)*pos] & SPACE) {
+            return DOT_TYPE;
 
-                strncat(buffer, &charRead, 1);
+        }
+        // otherwise the dot starts a number or symbol such as .9432
+    }
 
-                if (charRead == '\\') {  // Read whatever is after "\" into the string
-                    charRead = (char)fgetc(stdin);
-                    strncat(buffer, &charRead, 1);
-                }
+    if (charRead == '(') {
+        return OPEN_TYPE;
 
-                charRead = (char)fgetc(stdin);
-            }
+    } else if (charRead == ')') {
+        return CLOSE_TYPE;
 
-            char *token = talloc((strlen(buffer)+1)*sizeof(char));
-            strcpy(token, buffer);
+    } else if (charRead == '[') {
+        return OPENBRACKET_TYPE;
 
-            Value *newNode = talloc(sizeof(Value));
-            newNode->type = STR_TYPE;
-            newNode->s = token;
-            list = cons(newNode, list);
+    } else if (charRead == ']') {
+        return CLOSEBRACKET_TYPE;
 
-        } else if (charRead == '\''){
-            char nextChar = fgetc(stdin);
-            if (isspace(nextChar)) {
-                //error message
-                printf("Syntax error: untokenizeable (Invalid token ' position)\n");
+    } else if (charRead == '#') {
+        //test whether the token is #t or #f
+        int boolValue;
+        if (need(NULL, 1) && *pos == 't') {
+            boolValue = 1;
+        } else if (pos < end && *pos == 'f') {
+            boolValue = 0;
+        } else {
+            //error message
+            printf("Syntax error: untokenizeable (unvalid char after #)\n");
+            texit(0);
+        }
+        pos++;
+        //the boolean immediate
+        *datum = makeBool(boolValue);
+        return BOOL_TYPE;
+
+    } else if (charRead == '"'){  // string type
+        // whatever follows a backslash is kept in the string as it is
+        text = pos;
+        while (1) {
+            pos = scan(pos, end, FIND_STRING_END);
+            if (!need(&text, 1)) {
+                printf("Syntax error: untokenizeable (unterminated string)\n");
                 texit(0);
+            } else if (*pos == '"') {
+                break;
+            } else if (*pos == '\\') {
+                if (!need(&text, 2)) {
+                    printf("Syntax error: untokenizeable (unterminated string)\n");
+                    texit(0);
+                }
+                pos += 2;
             }
+        }
 
-            ungetc(nextChar, stdin);
+        long length = pos - text;
+        char *token = talloc((length + 1)*sizeof(char));
+        memcpy(token, text, length);
+        token[length] = '\0';
+        pos++;
+
+        Value *newNode = tallocValue();
+        newNode->type = STR_TYPE;
+        newNode->s = token;
+        *datum = newNode;
+        return STR_TYPE;
+
+    } else if (charRead == '\''){
+        if (need(NULL, 1) && (charClass[(unsigned char)*pos] & SPACE)) {
+            //error message
+            printf("Syntax error: untokenizeable (Invalid token ' position)\n");
+            texit(0);
+        }
+        return SINGLEQUOTE_TYPE;
 
-            Value *closeNode = talloc(sizeof(Value));
-            closeNode->type = SINGLEQUOTE_TYPE;
-            closeNode->s = talloc(2);
-            strcpy(closeNode->s,"\'");
-            list = cons(closeNode, list);
+    }
 
-        } else if (charRead == ';'){  // comment case
-            while (charRead != '\n' && charRead != '\r' && charRead != EOF){
-                charRead = (char)fgetc(stdin);
-            }
+    //find the int/double/symbol token
+    while (1) {
+        pos = scan(pos, end, FIND_DELIMITER);
+        if (pos < end || !fill(&text)) {
+            break;
+        }
+    }
+    *datum = readAtom(text, pos - text);
+    return typeOf(*datum);
+}
 
-        } else {
-            while (isspace(charRead)) {
-                charRead = (char)fgetc(stdin);
-            }
+Value *punctuation(valueType type) {
+    char *text;
+    switch (type) {
+        case OPEN_TYPE:
+            text = "(";
+            break;
 
+        case CLOSE_TYPE:
+            text = ")";
+            break;
 
+        case OPENBRACKET_TYPE:
+            text = "[";
+            break;
 
-            //find the int/double/symbol token
-            memset((void*)buffer, '\0', sizeof(char)*300);
-            while (!isspace(charRead) && charRead != EOF) {
-                if (charRead == '#' || charRead == ')' || charRead == ']') { //add ]
-                    ungetc(charRead, stdin);
-                    break;
-                }
+        case CLOSEBRACKET_TYPE:
+            text = "]";
+            break;
 
-                strncat(buffer, &charRead, 1);
-                charRead = (char)fgetc(stdin);
-            }
+        case DOT_TYPE:
+            text = ".";
+            break;
 
+        default:
+            text = "\'";
+            break;
+    }
+    Value *token = tallocValue();
+    token->type = type;
+    token->s = talloc(strlen(text) + 1);
+    strcpy(token->s, text);
+    return token;
+}
 
-            //give buffer and clear up its content
-            char *token = talloc((strlen(buffer)+1)*sizeof(char));
-            strcpy(token, buffer);
-
-            
-            //test and insert result into the linked list
-            Value *newNode = talloc(sizeof(Value));
-            if (isuinteger(token)) {
-                //test int
-                newNode->type = INT_TYPE;
-                newNode->i = (int)strtol(token, NULL, 10);
-            } else if (isudecimal(token)) {
-                //test double
-                newNode->type = DOUBLE_TYPE;
-                newNode->d = strtod(token, NULL);
-            } else if (issymbol(token)) {
-                newNode->type = SYMBOL_TYPE;
-                newNode->s = token;
-            } else {
-                //error message
-                printf("Syntax error: untokenizeable (Invalid token %s)\n", token);
-                texit(0);
+// An optional sign, then digits with at most one '.', is a number: a double
+// if it has the '.', and otherwise an integer. The digits are accumulated
+// as they are checked. An integer with more digits than that adds up
+// safely, or a double with more digits or decimals than can be divided out
+// exactly, is converted again by strtol or strtod, which round it the same
+// way; an integer outside the fixnum range becomes a double.
+static Value *readAtom(char *text, long length) {
+    char *stop = text + length;
+    char *curr = text;
+    int negative = 0;
+    if (*curr == '+' || *curr == '-') {
+        negative = *curr == '-';
+        curr++;
+    }
+    char *unsignedText = curr;
+
+    unsigned long digits = 0;
+    int count = 0;
+    int decimals = -1;  // no '.' yet
+    for (; curr < stop; curr++) {
+        unsigned digit = (unsigned char)*curr - '0';
+        if (digit < 10) {
+            if (count < 19) {
+                digits = digits * 10 + digit;
             }
-            list = cons(newNode, list); 
+            count++;
+            if (decimals >= 0) {
+                decimals++;
+            }
+        } else if (*curr == '.' && decimals < 0) {
+            decimals = 0;
+        } else {
+            break;
         }
-        
-        //strip all space
-        do {
-            charRead = (char)fgetc(stdin);
-        } while (isspace(charRead));
-
-        totalToken++;
     }
 
+    // a sign on its own is a symbol
+    if (curr == stop && curr > unsignedText) {
+        if (decimals < 0 && count <= 18) {
+            //integers are immediates
+            return makeFixnum(negative ? -(long)digits : (long)digits);
+        } else if (decimals >= 0 && count <= 15 && decimals <= 22) {
+            Value *newNode = tallocValue();
+            newNode->type = DOUBLE_TYPE;
+            newNode->d = (double)digits / powersOfTen[decimals];
+            if (negative && count > 0) {  // strtod gives +0 for "-."
+                newNode->d = -newNode->d;
+            }
+            return newNode;
+        }
 
-    Value *revList = reverse(list);
-    return revList;
-}
-
-// Displays the contents of the linked list as tokens, with type information
-void displayTokens(Value *list) {
-    
-    for (Value *curr = list; curr->type != NULL_TYPE; curr = cdr(curr)) {
-        switch(car(curr)->type){
-            case INT_TYPE:
-                printf("%i:integer\n", car(curr)->i);
-                break;
-
-            case DOUBLE_TYPE:
-                printf("%lf:double\n", car(curr)->d);
-                break;
+        // strtol and strtod need the number to end in a terminator
+        char *number = talloc(length + 1);
+        memcpy(number, text, length);
+        number[length] = '\0';
+        if (decimals < 0) {
+            errno = 0;
+            long integer = strtol(number, NULL, 10);
+            if (errno != ERANGE && integer >= FIXNUM_MIN && integer <= FIXNUM_MAX) {
+                return makeFixnum(integer);
+            }
+        }
+        Value *newNode = tallocValue();
+        newNode->type = DOUBLE_TYPE;
+        newNode->d = strtod(number, NULL);
+        return newNode;
+    }
 
-            case OPEN_TYPE:
-                printf("%s:open\n", car(curr)->s);
-                break;
+    if (issymbol(text, length)) {
+        //every occurrence of a name shares one interned symbol
+        return internLength(text, length);
+    }
+    //error message
+    printf("Syntax error: untokenizeable (Invalid token %.*s)\n", (int)length, text);
+    texit(0);
+    return NULL;
+}
 
-            case CLOSE_TYPE:
-                printf("%s:close\n", car(curr)->s);
-                break;
+static void openInput() {
+#if defined(__x86_64__)
+    if (getenv("TOKENIZER_SCALAR") == NULL) {
+        scan = __builtin_cpu_supports("avx2") ? scanAVX2 : scanSSE2;
+    }
+#endif
+
+    struct stat status;
+    off_t offset = lseek(0, 0, SEEK_CUR);
+    if (fstat(0, &status) == 0 && S_ISREG(status.st_mode) && offset >= 0
+        && status.st_size > offset) {
+        char *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, status.st_size, MADV_SEQUENTIAL);
+            buffer = map;
+            pos = map + offset;
+            end = map + status.st_size;
+            mapped = 1;
+            return;
+        }
+    }
+    capacity = BLOCK_SIZE;
+    buffer = malloc(capacity);
+    pos = buffer;
+    end = buffer;
+}
 
-            case OPENBRACKET_TYPE:
-                printf("%s:openbracket\n", car(curr)->s);
-                break;
+static int fill(char **keep) {
+    if (mapped || atEnd) {
+        return 0;
+    }
+    char *from = keep != NULL ? *keep : pos;
+    long kept = end - from;
+    long scanned = pos - from;
+    memmove(buffer, from, kept);
+    if (kept == capacity) {
+        capacity *= 2;
+        buffer = realloc(buffer, capacity);
+    }
+    if (keep != NULL) {
+        *keep = buffer;
+    }
+    pos = buffer + scanned;
+    end = buffer + kept;
+
+    long count;
+    do {
+        count = read(0, end, capacity - kept);
+    } while (count < 0 && errno == EINTR);
+    if (count <= 0) {
+        atEnd = 1;
+        return 0;
+    }
+    end += count;
+    return 1;
+}
 
-            case CLOSEBRACKET_TYPE:
-                printf("%s:closebracket\n", car(curr)->s);
-                break;
+static int need(char **keep, long count) {
+    while (end - pos < count) {
+        if (!fill(keep)) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-            case DOT_TYPE:
-                printf("%s:dot\n", car(curr)->s);
-                break;
-            
-            case SINGLEQUOTE_TYPE:
-                printf("':single quote\n");
-                break;
+static char *scanScalar(char *from, char *to, int kind) {
+    switch (kind) {
+        case SKIP_SPACE:
+            while (from < to && (charClass[(unsigned char)*from] & SPACE)) {
+                from++;
+            }
+            return from;
 
-            case BOOL_TYPE:
-                if(car(curr)->i == 0){
-                    printf("#f:boolean\n");
-                }else{
-                    printf("#t:boolean\n");
-                }
-                break;
-                
-            case SYMBOL_TYPE:
-                printf("%s:symbol\n", car(curr)->s);
-                break;
+        case FIND_LINE_END:
+            while (from < to && *from != '\n' && *from != '\r') {
+                from++;
+            }
+            return from;
 
-            case STR_TYPE:
-                printf("\"%s\":string\n", car(curr)->s);
-                break;
+        case FIND_STRING_END:
+            while (from < to && *from != '"' && *from != '\\') {
+                from++;
+            }
+            return from;
 
-            default:
-                break;
-        }
+        default:
+            while (from < to && !(charClass[(unsigned char)*from] & DELIMITER)) {
+                from++;
+            }
+            return from;
     }
 }
 
+#if defined(__x86_64__)
+// The vector kernels compare a block of 16 or 32 bytes at a time against
+// the bytes they look for, and finish the last partial block with
+// scanScalar(). Most atoms and gaps between tokens are short, so the first
+// SCALAR_PREFIX bytes are scanned one at a time and only longer runs, such
+// as comments and long strings, reach the vector loop. Whitespace is ' ' or
+// a byte from '\t' to '\r', which is an unsigned byte of at most 4 once
+// '\t' is subtracted.
+#define SCALAR_PREFIX 16
+
+static char *scanSSE2(char *from, char *to, int kind) {
+    char *prefixEnd = to - from > SCALAR_PREFIX ? from + SCALAR_PREFIX : to;
+    from = scanScalar(from, prefixEnd, kind);
+    if (from < prefixEnd || from == to) {
+        return from;
+    }
 
-//check if the input string is a integer
-int isuinteger(char *str) {
-    int index = 0;
-    if (str[0] == '+' || str[0] == '-') {
-        if (strlen(str) == 1) {
-            return 0;
-        }
-        
-        index = 1;
+    __m128i blank = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i four = _mm_set1_epi8(4);
+    __m128i first, second, third;
+    switch (kind) {
+        case FIND_LINE_END:
+            first = _mm_set1_epi8('\n');
+            second = _mm_set1_epi8('\r');
+            break;
+
+        case FIND_STRING_END:
+            first = _mm_set1_epi8('"');
+            second = _mm_set1_epi8('\\');
+            break;
+
+        default:
+            first = _mm_set1_epi8('#');
+            second = _mm_set1_epi8(')');
+            third = _mm_set1_epi8(']');
+            break;
     }
-    for (; index < strlen(str); index++) {
-        if (!isdigit(str[index])){
-            return 0;
+
+    while (to - from >= 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i *)from);
+        __m128i found;
+        if (kind == FIND_LINE_END || kind == FIND_STRING_END) {
+            found = _mm_or_si128(_mm_cmpeq_epi8(chunk, first), _mm_cmpeq_epi8(chunk, second));
+        } else {
+            __m128i shifted = _mm_sub_epi8(chunk, tab);
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(chunk, blank),
+                _mm_cmpeq_epi8(_mm_min_epu8(shifted, four), shifted));
+            if (kind == SKIP_SPACE) {
+                found = _mm_cmpeq_epi8(space, _mm_setzero_si128());
+            } else {
+                found = _mm_or_si128(_mm_or_si128(space, _mm_cmpeq_epi8(chunk, first)),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, second), _mm_cmpeq_epi8(chunk, third)));
+            }
+        }
+        unsigned mask = _mm_movemask_epi8(found);
+        if (mask != 0) {
+            return from + __builtin_ctz(mask);
         }
+        from += 16;
     }
-    return 1;
+    return scanScalar(from, to, kind);
 }
 
-//check if the input string is a decimal
-int isudecimal(char *str) {
-    int index = 0;
-    int hasDecimal = 0;
+__attribute__((target("avx2")))
+static char *scanAVX2(char *from, char *to, int kind) {
+    char *prefixEnd = to - from > SCALAR_PREFIX ? from + SCALAR_PREFIX : to;
+    from = scanScalar(from, prefixEnd, kind);
+    if (from < prefixEnd || from == to) {
+        return from;
+    }
 
-    if (str[0] == '+' || str[0] == '-'){
-        if (strlen(str) == 1) {
-            return 0;
-        }
-        index = 1;
+    __m256i blank = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i four = _mm256_set1_epi8(4);
+    __m256i first, second, third;
+    switch (kind) {
+        case FIND_LINE_END:
+            first = _mm256_set1_epi8('\n');
+            second = _mm256_set1_epi8('\r');
+            break;
+
+        case FIND_STRING_END:
+            first = _mm256_set1_epi8('"');
+            second = _mm256_set1_epi8('\\');
+            break;
+
+        default:
+            first = _mm256_set1_epi8('#');
+            second = _mm256_set1_epi8(')');
+            third = _mm256_set1_epi8(']');
+            break;
     }
-    for (; index < strlen(str); index++){
-        if (str[index] == '.' && hasDecimal != 1){
-            hasDecimal = 1;
-        } else if (!isdigit(str[index])){
-            return 0;
+
+    while (to - from >= 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i *)from);
+        __m256i found;
+        if (kind == FIND_LINE_END || kind == FIND_STRING_END) {
+            found = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, first), _mm256_cmpeq_epi8(chunk, second));
+        } else {
+            __m256i shifted = _mm256_sub_epi8(chunk, tab);
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, blank),
+                _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, four), shifted));
+            if (kind == SKIP_SPACE) {
+                found = _mm256_cmpeq_epi8(space, _mm256_setzero_si256());
+            } else {
+                found = _mm256_or_si256(_mm256_or_si256(space, _mm256_cmpeq_epi8(chunk, first)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, second), _mm256_cmpeq_epi8(chunk, third)));
+            }
+        }
+        unsigned mask = _mm256_movemask_epi8(found);
+        if (mask != 0) {
+            return from + __builtin_ctz(mask);
         }
+        from += 32;
     }
-
-    return hasDecimal;
+    return scanScalar(from, to, kind);
 }
+#endif
 
-int issymbol(char *str) {
-    if (strlen(str) == 1) {
+int issymbol(char *str, long length) {
+    if (length == 1) {
         char chr = str[0];
         if (isinitial(chr) || chr == '+' || chr == '-') {
             return 1;
@@ -325,7 +577,7 @@ int issymbol(char *str) {
     }
     
     //first check subsequent elements are valid
-    for (int index = 1; index < strlen(str); index ++) {
+    for (long index = 1; index < length; index ++) {
         if (!issubsequent(str[index])){
             return 0;
         }
@@ -335,19 +587,9 @@ int issymbol(char *str) {
 }
 
 int isinitial(char chr) {
-    char specialChar[15] = "!$%&*/:<=>?~_^";
-    for (int i = 0; i < 14; i++){
-        if(chr == specialChar[i]){
-            return 1;
-        }
-    }
-    return isalpha(chr);
+    return charClass[(unsigned char)chr] & INITIAL;
 }
 
 int issubsequent(char chr) {
-    if(isinitial(chr) || isdigit(chr) ||
-       chr == '.' || chr == '+' || chr == '-'){
-            return 1;
-    }
-    return 0;
-}
\ No newline at end of file
+    return charClass[(unsigned char)chr] & SUBSEQUENT;
+}
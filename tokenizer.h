@@ -7,6 +7,20 @@
 // tokens.
 Value *tokenize();
 
+// Read the next token from stdin and return it, or NULL at the end of the
+// input. stdin is mapped when it is a regular file and otherwise read a
+// block at a time, but never waited on past the end of the token.
+Value *nextToken();
+
+// Read the next token from stdin like nextToken(), but without making a
+// value of punctuation: return the type of the token, which is NULL_TYPE
+// at the end of the input, and store a number, boolean, string or symbol
+// at datum.
+valueType readToken(Value **datum);
+
+// A token value for punctuation of the given type, holding its text.
+Value *punctuation(valueType type);
+
 // Displays the contents of the linked list as tokens, with type information
 void displayTokens(Value *list);
 
@@ -1,6 +1,8 @@
 #ifndef _VALUE
 #define _VALUE
 
+#include <stdint.h>
+
 typedef enum {
     INT_TYPE, DOUBLE_TYPE, STR_TYPE, CONS_TYPE, NULL_TYPE, PTR_TYPE,
     OPEN_TYPE, CLOSE_TYPE, BOOL_TYPE, SYMBOL_TYPE,
@@ -14,12 +16,19 @@ typedef enum {
     // Type below is new for primitive portion
     PRIMITIVE_TYPE,
 
+    // A variable that closures capture and that is assigned lives in a box
+    // (its car) shared by its frame and the closures. Boxes sit only in frame
+    // slots and are never the value of an expression.
+    BOX_TYPE,
+
 } valueType;
 
+// Only values that need storage live on the heap. Integers, booleans, the
+// empty list and void are immediates encoded in the Value pointer itself (see
+// below), so they never have a struct Value behind them.
 struct Value {
     valueType type;
     union {
-        int i;
         double d;
         char *s;
         void *p;
@@ -29,34 +38,167 @@ struct Value {
         } c;
         // For purposes of this project a closure is just another type of value,
         // containing everything needed to execute a user-defined function: (1)
-        // a list of formal parameter names; (2) a pointer to the function body;
-        // (3) a pointer to the environment frame in which the function was
-        // created.
+        // the analyzed LAMBDA_NODE, which knows the parameters, the size of
+        // the frame and the body; (2) a frame holding only the variables the
+        // body uses from where the function was created, or NULL if it uses
+        // none. It becomes the parent of the frame of each call.
         struct Closure {
-            struct Value *paramNames;
-            struct Value *fnBody;
+            struct Node *code;
             struct Frame *frame;
         } closure;
         
         // A primitive style function; just a pointer to it, with the right
-        // signature (primFn = primitive function)
-        struct Value *(*primFn)(struct Value *);
+        // signature (primFn = primitive function). It is passed the number
+        // of arguments and a pointer to the first, which point into the
+        // evaluator's stack and are only valid during the call.
+        struct Value *(*primFn)(int argc, struct Value **argv);
     };
 };
 
 typedef struct Value Value;
 
 
-// A frame is a linked list of bindings, and a pointer to another frame.  A
-// binding is a variable name (represented as a string), and a pointer to the
-// Value it is bound to.
+// A frame holds the variables of one scope. The analyzer numbers the
+// variables of every lambda, let, let* and letrec, so a frame is just an
+// array of count slots and a pointer to the enclosing frame. A slot holding
+// NULL is a variable that has not been bound yet.
+//
+// The global frame has no slots, because top-level definitions are only known
+// as they run. It keeps its bindings in table instead: an open-addressing hash
+// table of binding cons cells (symbol . value) keyed on the interned symbol.
+// Local frames leave table NULL.
 struct Frame {
-    struct Value *bindings;
     struct Frame *parent;
+    struct Value **table;
+    int tableCount;
+    int tableCapacity;
+    int count;
+    struct Value *slots[];
 };
 
 typedef struct Frame Frame;
 
+// Kinds of analyzed expression; see struct Node.
+typedef enum {
+    CONSTANT_NODE, VARIABLE_NODE, IF_NODE, LET_NODE, LETSTAR_NODE, LETREC_NODE,
+    SET_NODE, BEGIN_NODE, DEFINE_NODE, LAMBDA_NODE, AND_NODE, OR_NODE,
+    COND_NODE, CALL_NODE, ERROR_NODE
+} nodeKind;
+
+// Before it is run, every expression is analyzed once into a tree of nodes.
+// The syntax has been checked, the special form recognized and every variable
+// resolved, so running a node only dispatches on kind. What the fields hold
+// depends on kind:
+//
+//   CONSTANT_NODE  value is the datum
+//   VARIABLE_NODE, value is the symbol. A local variable is slot index of the
+//   SET_NODE,      frame depth levels up; depth is -1 for a global. SET and
+//   DEFINE_NODE    DEFINE have the new value as their child. A global's
+//                  binding cell is cached in binding the first time it is
+//                  found. boxed is set for a local that may be held in a box
+//   IF_NODE        children are test, consequent and alternative
+//   LET_NODE       children are one initializer per binding, then the body;
+//                  the bindings go in slots 0 to index - 1 of a new frame
+//   LETSTAR_NODE   children are a DEFINE_NODE per binding, then the body, all
+//                  run in one new frame
+//   LETREC_NODE    like LET_NODE, but the initializers run in the new frame
+//   BEGIN_NODE,    children are the subexpressions
+//   AND_NODE,
+//   OR_NODE
+//   LAMBDA_NODE    value is the parameter list (or rest symbol), the first
+//                  child is the body; the index parameters fill the first
+//                  slots. The other children are VARIABLE_NODEs for the
+//                  variables the body uses from where the lambda is run,
+//                  which a closure copies into its frame (see
+//                  flattenClosures in closures.h); a boxed one is copied as
+//                  its box
+//   COND_NODE      children are a test and a body per clause; the test of an
+//                  else clause is NULL
+//   CALL_NODE      children are the operator and then the operands; index
+//                  is the fastPath (interpreter.h) the call site may take
+//   ERROR_NODE     value is a STR_TYPE message printed when the node runs, so
+//                  syntax errors surface only when the faulty code is reached
+//
+// LET, LETSTAR, LETREC and LAMBDA nodes create frames of frameSize slots.
+// When the bytecode machine runs a LAMBDA_NODE or a top-level form, it keeps
+// the compiled code in bytecode. A LAMBDA_NODE counts its calls in calls, and
+// native is its machine code once the JIT (jit.h) has compiled it; native is
+// not on the heap. In a program compiled ahead of time (aot.h), a LAMBDA_NODE
+// has no body and compiled is the C function generated for it.
+struct Node {
+    nodeKind kind;
+    int count;
+    struct Value *value;
+    int depth;
+    int index;
+    int frameSize;
+    int boxed;
+    int calls;
+    struct Code *bytecode;
+    struct Value *binding;
+    struct Native *native;
+    struct Value *(*compiled)(struct Value **activation);
+    struct Node *children[];
+};
+
+typedef struct Node Node;
+
+// Immediate encoding. Heap objects are 8-byte aligned, so the low bits of a
+// real Value pointer are zero. A pointer with the low bit set is a fixnum
+// holding the integer in its upper 63 bits; a pointer whose low bits are 010
+// is one of the constants below. Type checks on immediates are bit tests and
+// never touch memory.
+#define NULL_VALUE ((Value *)0x02)
+#define FALSE_VALUE ((Value *)0x0a)
+#define TRUE_VALUE ((Value *)0x12)
+#define VOID_VALUE ((Value *)0x1a)
+
+// The build does not optimize, so ask for these helpers to be inlined anyway;
+// as out-of-line calls they cost more than the loads they replace.
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// Nonzero for fixnums and the constants above.
+ALWAYS_INLINE int isImmediate(Value *value) {
+    return ((uintptr_t)value & 3) != 0;
+}
+
+ALWAYS_INLINE int isFixnum(Value *value) {
+    return ((uintptr_t)value & 1) != 0;
+}
+
+ALWAYS_INLINE Value *makeFixnum(long number) {
+    return (Value *)(((uintptr_t)number << 1) | 1);
+}
+
+ALWAYS_INLINE long fixnumValue(Value *value) {
+    return (long)((intptr_t)value >> 1);
+}
+
+// Range of integers a fixnum can hold.
+#define FIXNUM_MAX ((long)(INTPTR_MAX >> 1))
+#define FIXNUM_MIN ((long)(INTPTR_MIN >> 1))
+
+ALWAYS_INLINE Value *makeBool(int boolean) {
+    return boolean ? TRUE_VALUE : FALSE_VALUE;
+}
+
+// Type of any value, immediate or not.
+ALWAYS_INLINE valueType typeOf(Value *value) {
+    if ((uintptr_t)value & 1) {
+        return INT_TYPE;
+    }
+    if ((uintptr_t)value & 2) {
+        return value == NULL_VALUE ? NULL_TYPE
+             : value == VOID_VALUE ? VOID_TYPE : BOOL_TYPE;
+    }
+    return value->type;
+}
+
+// Nonzero for the box of an assigned, captured variable; see BOX_TYPE.
+ALWAYS_INLINE int isBox(Value *value) {
+    return value != NULL && !isImmediate(value) && value->type == BOX_TYPE;
+}
+
 
 
 
@@ -0,0 +1,805 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "linkedlist.h"
+#include "talloc.h"
+#include "value.h"
+#include "interpreter.h"
+#include "vm.h"
+#include "jit.h"
+
+// Instructions of the stack machine. An instruction is a word holding the
+// opcode followed by one word per operand. Jump offsets count words from the
+// jumping instruction.
+typedef enum {
+    OP_IMMEDIATE,     // value: push an immediate value
+    OP_CONSTANT,      // node: push the value of a CONSTANT_NODE
+    OP_LOCAL,         // depth index: push a local variable
+    OP_BOXED_LOCAL,   // depth index: push a local variable that may be boxed
+    OP_GLOBAL,        // node: push a global variable
+    OP_SET_LOCAL,     // depth index: pop into a local variable, push void
+    OP_SET_GLOBAL,    // node: pop into a global variable if it exists, push void
+    OP_DEFINE_LOCAL,  // index: pop into a slot of the current frame, push void
+    OP_DEFINE_GLOBAL, // symbol: pop into a new or existing global, push void
+    OP_POP,
+    OP_JUMP,          // offset
+    OP_IF_FALSE,      // offset: pop the test of an if, jump if it is #f
+    OP_COND_FALSE,    // offset: pop the test of a cond clause, jump if it is #f
+    OP_AND,           // offset: jump if the top is #f, otherwise pop it
+    OP_OR,            // offset: jump unless the top is #f, otherwise pop it
+    OP_LET,           // count size: pop count values into a new frame of size slots
+    OP_ENTER,         // size: make a new frame of size slots current
+    OP_BIND,          // count: pop count values into the first slots of the frame
+    OP_LEAVE,         // make the parent of the current frame current again
+    OP_CLOSURE,       // node: push a closure of a LAMBDA_NODE run in the current frame
+    OP_FAST,          // path: do a two-operand call followed by OP_CALL or
+                      // OP_TAIL_CALL at the call site if fixnumFastPath can
+    OP_CALL,          // argc: call the procedure below argc arguments
+    OP_TAIL_CALL,     // argc: the same, replacing the current call
+    OP_RETURN,        // return the top to the caller
+    OP_ERROR,         // node: report the error of an ERROR_NODE
+    OP_HALT           // return the top to vmExecute's caller
+} opcode;
+
+// Compiled code: the instructions of one top-level form or procedure body.
+// Code is raw memory in the old generation, kept alive by the node it was
+// compiled from, so it never moves and return addresses can point into it.
+struct Code {
+    int stackSize;    // most operand stack slots the code uses at once
+    int length;
+    intptr_t words[];
+};
+
+typedef struct Code Code;
+
+// Code being compiled, with the depth of the operand stack at the current
+// point of it.
+typedef struct Compiler {
+    intptr_t *words;
+    int length;
+    int capacity;
+    int depth;
+    int maxDepth;
+} Compiler;
+
+// The operand stack holds intermediate values and, below the operands of
+// each active procedure, the frame of its caller. It is raw memory registered
+// with the collector, which traces the entries below stackTop; the machine
+// keeps its stack pointer in a local and stores it in stackTop before every
+// safepoint. Return addresses go on a separate stack the collector ignores,
+// each with the frame stack mark of the activation it returns to.
+static Value **stack = NULL;
+static Value **stackTop = NULL;
+static Value **stackLimit = NULL;
+static intptr_t **returns = NULL;
+static intptr_t **returnTop = NULL;
+static intptr_t **returnLimit = NULL;
+
+// The frame of top-level definitions, which vmExecute is given.
+static Frame *globalFrame = NULL;
+
+//Helper Functions
+//allocate the stacks of the machine
+static void initStacks();
+//move the operand stack to a bigger block with room for needed more entries
+static Value **growStack(Value **sp, int needed);
+//move the return stack to a bigger block
+static intptr_t **growReturns(intptr_t **rsp);
+//compile body into code ending with last, and keep it in node
+static Code *compile(Node *node, Node *body, opcode last);
+//compile a node; tail is nonzero when its value is returned from a procedure
+static void compileNode(Compiler *compiler, Node *node, int tail);
+//compile children first to last of node, keeping only the value of the last
+static void compileSequence(Compiler *compiler, Node *node, int first, int tail);
+//append a word to the code
+static void emit(Compiler *compiler, intptr_t word);
+//append an opcode that changes the stack depth by stackEffect
+static void emitOp(Compiler *compiler, opcode op, int stackEffect);
+//append a jump whose offset is filled in later by patchJump; returns its position
+static int emitJump(Compiler *compiler, opcode op, int stackEffect);
+//make the jump at position land at the end of the code
+static void patchJump(Compiler *compiler, int position);
+//list of argc arguments on the stack
+static Value *argumentList(Value **args, int argc);
+//frame of a closure call with argc arguments on the stack
+static Frame *bindArguments(Value *closure, Value **args, int argc);
+//run code in frame until it halts; with call nonzero the code is a procedure
+//body, whose return halts
+static Value *run(Code *code, Frame *frame, int call);
+
+// Where a procedure run by vmApply returns to.
+static intptr_t haltWords[] = {OP_HALT};
+
+Value *vmExecute(Node *node, Frame *frame){
+    globalFrame = frame;
+    Code *code = node->bytecode != NULL ? node->bytecode : compile(node, node, OP_HALT);
+    return run(code, globalFrame, 0);
+}
+
+// The frames of the call are released when it returns.
+Value *vmApply(Value *closure, int argc, Value **argv){
+    void *mark = frameStackMark();
+    Frame *callee = bindArguments(closure, argv, argc);
+    Node *lambda = closure->closure.code;
+    Code *code = lambda->bytecode != NULL ? lambda->bytecode : compile(lambda, lambda->children[0], OP_RETURN);
+    Value *result = run(code, callee, 1);
+    frameStackRelease(mark);
+    return result;
+}
+
+static Value *run(Code *code, Frame *frame, int call){
+    static void *dispatch[] = {
+        [OP_IMMEDIATE] = &&doImmediate,
+        [OP_CONSTANT] = &&doConstant,
+        [OP_LOCAL] = &&doLocal,
+        [OP_BOXED_LOCAL] = &&doBoxedLocal,
+        [OP_GLOBAL] = &&doGlobal,
+        [OP_SET_LOCAL] = &&doSetLocal,
+        [OP_SET_GLOBAL] = &&doSetGlobal,
+        [OP_DEFINE_LOCAL] = &&doDefineLocal,
+        [OP_DEFINE_GLOBAL] = &&doDefineGlobal,
+        [OP_POP] = &&doPop,
+        [OP_JUMP] = &&doJump,
+        [OP_IF_FALSE] = &&doIfFalse,
+        [OP_COND_FALSE] = &&doCondFalse,
+        [OP_AND] = &&doAnd,
+        [OP_OR] = &&doOr,
+        [OP_LET] = &&doLet,
+        [OP_ENTER] = &&doEnter,
+        [OP_BIND] = &&doBind,
+        [OP_LEAVE] = &&doLeave,
+        [OP_CLOSURE] = &&doClosure,
+        [OP_FAST] = &&doFast,
+        [OP_CALL] = &&doCall,
+        [OP_TAIL_CALL] = &&doTailCall,
+        [OP_RETURN] = &&doReturn,
+        [OP_ERROR] = &&doError,
+        [OP_HALT] = &&doHalt,
+    };
+
+    if (stack == NULL) {
+        initStacks();
+    }
+    Value **sp = stackTop;
+    intptr_t **rsp = returnTop;
+    intptr_t *pc = code->words;
+    // Frames come off the frame stack (see tallocStackFrame); everything
+    // above activation belongs to the running procedure.
+    void *activation = frameStackMark();
+    if (sp + code->stackSize + 1 > stackLimit) {
+        sp = growStack(sp, code->stackSize + 1);
+    }
+    if (call) {
+        if (rsp + 2 > returnLimit) {
+            rsp = growReturns(rsp);
+        }
+        *rsp++ = haltWords;
+        *rsp++ = activation;
+        *sp++ = NULL;
+    }
+    gcPushRoot(&frame);
+
+#define DISPATCH() goto *dispatch[*pc]
+    DISPATCH();
+
+doImmediate:
+    *sp++ = (Value *)pc[1];
+    pc += 2;
+    DISPATCH();
+
+doConstant:
+    *sp++ = ((Node *)pc[1])->value;
+    pc += 2;
+    DISPATCH();
+
+doLocal: {
+    Frame *scope = frame;
+    for (intptr_t depth = pc[1]; depth > 0; depth--) {
+        scope = scope->parent;
+    }
+    Value *value = scope->slots[pc[2]];
+    if (value == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    *sp++ = value;
+    pc += 3;
+    DISPATCH();
+}
+
+doBoxedLocal: {
+    Frame *scope = frame;
+    for (intptr_t depth = pc[1]; depth > 0; depth--) {
+        scope = scope->parent;
+    }
+    Value *value = scope->slots[pc[2]];
+    if (isBox(value)) {
+        value = value->c.car;
+    }
+    if (value == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    *sp++ = value;
+    pc += 3;
+    DISPATCH();
+}
+
+doGlobal: {
+    Value *binding = ((Node *)pc[1])->binding;
+    if (binding == NULL) {
+        binding = globalBinding((Node *)pc[1]);
+    }
+    if (binding == NULL) {
+        printf("Evaluation error: variable that is not bound in the current frame or any of its ancestors\n");
+        texit(0);
+    }
+    *sp++ = binding->c.cdr;
+    pc += 2;
+    DISPATCH();
+}
+
+doSetLocal: {
+    Frame *scope = frame;
+    for (intptr_t depth = pc[1]; depth > 0; depth--) {
+        scope = scope->parent;
+    }
+    setLocal(scope, (int)pc[2], sp[-1]);
+    sp[-1] = VOID_VALUE;
+    pc += 3;
+    DISPATCH();
+}
+
+doSetGlobal: {
+    Value *binding = globalBinding((Node *)pc[1]);
+    if (binding != NULL) {
+        binding->c.cdr = sp[-1];
+        gcWriteBarrier(binding);
+    }
+    sp[-1] = VOID_VALUE;
+    pc += 2;
+    DISPATCH();
+}
+
+doDefineLocal:
+    setLocal(frame, (int)pc[1], sp[-1]);
+    sp[-1] = VOID_VALUE;
+    pc += 2;
+    DISPATCH();
+
+doDefineGlobal:
+    addBinding((Value *)pc[1], sp[-1], globalFrame);
+    sp[-1] = VOID_VALUE;
+    pc += 2;
+    DISPATCH();
+
+doPop:
+    sp--;
+    pc += 1;
+    DISPATCH();
+
+doJump:
+    pc += pc[1];
+    DISPATCH();
+
+doIfFalse: {
+    Value *condition = *--sp;
+    if (typeOf(condition) != BOOL_TYPE) {
+        printf("Evaluation error: condition of an if expression must be a boolean\n");
+        texit(0);
+    }
+    pc += condition == FALSE_VALUE ? pc[1] : 2;
+    DISPATCH();
+}
+
+doCondFalse: {
+    Value *condition = *--sp;
+    if (typeOf(condition) != BOOL_TYPE) {
+        printf("Evaluation error [cond]: incorrect type in condition\n");
+        texit(0);
+    }
+    pc += condition == FALSE_VALUE ? pc[1] : 2;
+    DISPATCH();
+}
+
+doAnd:
+    if (sp[-1] == FALSE_VALUE) {
+        pc += pc[1];
+    } else {
+        sp--;
+        pc += 2;
+    }
+    DISPATCH();
+
+doOr:
+    if (sp[-1] != FALSE_VALUE) {
+        pc += pc[1];
+    } else {
+        sp--;
+        pc += 2;
+    }
+    DISPATCH();
+
+doLet: {
+    int count = (int)pc[1];
+    Frame *inner = tallocStackFrame((int)pc[2]);
+    inner->parent = frame;
+    sp -= count;
+    memcpy(inner->slots, sp, sizeof(Value *) * count);
+    frame = inner;
+    pc += 3;
+    DISPATCH();
+}
+
+doEnter: {
+    Frame *inner = tallocStackFrame((int)pc[1]);
+    inner->parent = frame;
+    frame = inner;
+    pc += 2;
+    DISPATCH();
+}
+
+// The initializers have run since the frame was made, so it may be old.
+// A closure made by an initializer may have boxed a slot already.
+doBind: {
+    int count = (int)pc[1];
+    sp -= count;
+    for (int i = 0; i < count; i++) {
+        setLocal(frame, i, sp[i]);
+    }
+    pc += 2;
+    DISPATCH();
+}
+
+doLeave: {
+    Frame *left = frame;
+    frame = frame->parent;
+    frameStackRelease(left);
+    pc += 1;
+    DISPATCH();
+}
+
+doClosure:
+    *sp++ = makeClosure((Node *)pc[1], frame);
+    pc += 2;
+    DISPATCH();
+
+// On success the call instruction after this one is skipped, or finished
+// for a tail call by returning the result. Its safepoint stands in for the
+// call's.
+doFast: {
+    if (gcRequested) {
+        stackTop = sp;
+        gcCollectRequested();
+    }
+    Value *result = fixnumFastPath((fastPath)pc[1], sp[-3], sp[-2], sp[-1]);
+    if (result == NULL) {
+        pc += 2;
+        DISPATCH();
+    }
+    sp -= 3;
+    *sp++ = result;
+    if (pc[2] == OP_TAIL_CALL) {
+        goto doReturn;
+    }
+    pc += 4;
+    DISPATCH();
+}
+
+// A call saves the caller's frame on the operand stack and its return
+// address on the return stack, then runs the body in the callee's frame.
+doCall: {
+    int argc = (int)pc[1];
+    if (gcRequested) {
+        stackTop = sp;
+        gcCollectRequested();
+    }
+    Value *procedure = sp[-argc - 1];
+    if (typeOf(procedure) == PRIMITIVE_TYPE) {
+        Value *result = procedure->primFn(argc, sp - argc);
+        sp -= argc + 1;
+        *sp++ = result;
+        pc += 2;
+        DISPATCH();
+    }
+    // Native code may run the machine again above the tops, and the stacks
+    // may move meanwhile
+    if (typeOf(procedure) == CLOSURE_TYPE && jitReady(procedure->closure.code)) {
+        stackTop = sp;
+        returnTop = rsp;
+        Value *result = jitApply(procedure, argc, stackTop - argc);
+        sp = stackTop - argc - 1;
+        rsp = returnTop;
+        *sp++ = result;
+        pc += 2;
+        DISPATCH();
+    }
+
+    void *mark = frameStackMark();
+    Frame *callee = bindArguments(procedure, sp - argc, argc);
+    Node *lambda = procedure->closure.code;
+    Code *code = lambda->bytecode != NULL ? lambda->bytecode : compile(lambda, lambda->children[0], OP_RETURN);
+    sp -= argc + 1;
+    if (rsp + 2 > returnLimit) {
+        rsp = growReturns(rsp);
+    }
+    *rsp++ = pc + 2;
+    *rsp++ = activation;
+    activation = mark;
+    *sp++ = (Value *)frame;
+    if (sp + code->stackSize > stackLimit) {
+        sp = growStack(sp, code->stackSize);
+    }
+    frame = callee;
+    pc = code->words;
+    DISPATCH();
+}
+
+// A call in tail position reuses the caller's return address and saved frame,
+// and the callee's frame replaces the caller's on the frame stack, so loops
+// written as tail recursion run in constant space.
+doTailCall: {
+    int argc = (int)pc[1];
+    if (gcRequested) {
+        stackTop = sp;
+        gcCollectRequested();
+    }
+    Value *procedure = sp[-argc - 1];
+    if (typeOf(procedure) == PRIMITIVE_TYPE) {
+        Value *result = procedure->primFn(argc, sp - argc);
+        sp -= argc + 1;
+        *sp++ = result;
+        goto doReturn;
+    }
+
+    frameStackRelease(activation);
+    if (typeOf(procedure) == CLOSURE_TYPE && jitReady(procedure->closure.code)) {
+        stackTop = sp;
+        returnTop = rsp;
+        Value *result = jitApply(procedure, argc, stackTop - argc);
+        sp = stackTop - argc - 1;
+        rsp = returnTop;
+        *sp++ = result;
+        goto doReturn;
+    }
+    Frame *callee = bindArguments(procedure, sp - argc, argc);
+    Node *lambda = procedure->closure.code;
+    Code *code = lambda->bytecode != NULL ? lambda->bytecode : compile(lambda, lambda->children[0], OP_RETURN);
+    sp -= argc + 1;
+    if (sp + code->stackSize > stackLimit) {
+        sp = growStack(sp, code->stackSize);
+    }
+    frame = callee;
+    pc = code->words;
+    DISPATCH();
+}
+
+doReturn: {
+    Value *result = *--sp;
+    frame = (Frame *)*--sp;
+    frameStackRelease(activation);
+    activation = *--rsp;
+    pc = *--rsp;
+    *sp++ = result;
+    DISPATCH();
+}
+
+doError:
+    printf("%s\n", ((Node *)pc[1])->value->s);
+    texit(0);
+
+doHalt: {
+    Value *result = *--sp;
+    frameStackRelease(activation);
+    stackTop = sp;
+    returnTop = rsp;
+    gcPopRoots(1);
+    return result;
+}
+#undef DISPATCH
+}
+
+// The stacks are tenured raw blocks kept alive as global roots; the
+// collector only looks inside the operand stack.
+static void initStacks(){
+    int capacity = 1024;
+    stack = tallocTenured(sizeof(Value *) * capacity, RAW_KIND);
+    stackTop = stack;
+    stackLimit = stack + capacity;
+    gcAddGlobalRoot(&stack);
+    gcAddRootStack(&stack, &stackTop);
+
+    returns = tallocTenured(sizeof(intptr_t *) * capacity, RAW_KIND);
+    returnTop = returns;
+    returnLimit = returns + capacity;
+    gcAddGlobalRoot(&returns);
+    gcAddGlobalRoot(&globalFrame);
+}
+
+static Value **growStack(Value **sp, int needed){
+    int used = (int)(sp - stack);
+    int capacity = (int)(stackLimit - stack);
+    while (capacity < used + needed) {
+        capacity *= 2;
+    }
+    Value **bigger = tallocTenured(sizeof(Value *) * capacity, RAW_KIND);
+    memcpy(bigger, stack, sizeof(Value *) * used);
+    stack = bigger;
+    stackTop = stack + used;
+    stackLimit = stack + capacity;
+    return stackTop;
+}
+
+static intptr_t **growReturns(intptr_t **rsp){
+    int used = (int)(rsp - returns);
+    int capacity = (int)(returnLimit - returns) * 2;
+    intptr_t **bigger = tallocTenured(sizeof(intptr_t *) * capacity, RAW_KIND);
+    memcpy(bigger, returns, sizeof(intptr_t *) * used);
+    returns = bigger;
+    returnTop = returns + used;
+    returnLimit = returns + capacity;
+    return returnTop;
+}
+
+static Code *compile(Node *node, Node *body, opcode last){
+    Compiler compiler = {NULL, 0, 0, 0, 0};
+    compileNode(&compiler, body, last == OP_RETURN);
+    emitOp(&compiler, last, -1);
+
+    Code *code = tallocTenured(sizeof(Code) + sizeof(intptr_t) * compiler.length, RAW_KIND);
+    code->stackSize = compiler.maxDepth;
+    code->length = compiler.length;
+    memcpy(code->words, compiler.words, sizeof(intptr_t) * compiler.length);
+    free(compiler.words);
+    node->bytecode = code;
+    return code;
+}
+
+// Every node leaves exactly one value on the stack.
+static void compileNode(Compiler *compiler, Node *node, int tail){
+    switch (node->kind) {
+        case CONSTANT_NODE:
+            if (node->value == NULL || isImmediate(node->value)) {
+                emitOp(compiler, OP_IMMEDIATE, 1);
+                emit(compiler, (intptr_t)node->value);
+            } else {
+                emitOp(compiler, OP_CONSTANT, 1);
+                emit(compiler, (intptr_t)node);
+            }
+            break;
+
+        case VARIABLE_NODE:
+            if (node->depth < 0) {
+                emitOp(compiler, OP_GLOBAL, 1);
+                emit(compiler, (intptr_t)node);
+            } else {
+                emitOp(compiler, node->boxed ? OP_BOXED_LOCAL : OP_LOCAL, 1);
+                emit(compiler, node->depth);
+                emit(compiler, node->index);
+            }
+            break;
+
+        case IF_NODE: {
+            compileNode(compiler, node->children[0], 0);
+            int toElse = emitJump(compiler, OP_IF_FALSE, -1);
+            compileNode(compiler, node->children[1], tail);
+            int toEnd = emitJump(compiler, OP_JUMP, 0);
+            compiler->depth--;
+            patchJump(compiler, toElse);
+            compileNode(compiler, node->children[2], tail);
+            patchJump(compiler, toEnd);
+            break;
+        }
+
+        case LET_NODE:
+            for (int i = 0; i < node->index; i++) {
+                compileNode(compiler, node->children[i], 0);
+            }
+            emitOp(compiler, OP_LET, -node->index);
+            emit(compiler, node->index);
+            emit(compiler, node->frameSize);
+            compileSequence(compiler, node, node->index, tail);
+            emitOp(compiler, OP_LEAVE, 0);
+            break;
+
+        case LETSTAR_NODE:
+            emitOp(compiler, OP_ENTER, 0);
+            emit(compiler, node->frameSize);
+            compileSequence(compiler, node, 0, tail);
+            emitOp(compiler, OP_LEAVE, 0);
+            break;
+
+        case LETREC_NODE:
+            emitOp(compiler, OP_ENTER, 0);
+            emit(compiler, node->frameSize);
+            for (int i = 0; i < node->index; i++) {
+                compileNode(compiler, node->children[i], 0);
+            }
+            emitOp(compiler, OP_BIND, -node->index);
+            emit(compiler, node->index);
+            compileSequence(compiler, node, node->index, tail);
+            emitOp(compiler, OP_LEAVE, 0);
+            break;
+
+        case SET_NODE:
+            compileNode(compiler, node->children[0], 0);
+            if (node->depth < 0) {
+                emitOp(compiler, OP_SET_GLOBAL, 0);
+                emit(compiler, (intptr_t)node);
+            } else {
+                emitOp(compiler, OP_SET_LOCAL, 0);
+                emit(compiler, node->depth);
+                emit(compiler, node->index);
+            }
+            break;
+
+        case DEFINE_NODE:
+            compileNode(compiler, node->children[0], 0);
+            if (node->depth < 0) {
+                emitOp(compiler, OP_DEFINE_GLOBAL, 0);
+                emit(compiler, (intptr_t)node->value);
+            } else {
+                emitOp(compiler, OP_DEFINE_LOCAL, 0);
+                emit(compiler, node->index);
+            }
+            break;
+
+        case BEGIN_NODE:
+            compileSequence(compiler, node, 0, tail);
+            break;
+
+        case LAMBDA_NODE:
+            emitOp(compiler, OP_CLOSURE, 1);
+            emit(compiler, (intptr_t)node);
+            break;
+
+        case AND_NODE:
+        case OR_NODE: {
+            if (node->count == 0) {
+                emitOp(compiler, OP_IMMEDIATE, 1);
+                emit(compiler, (intptr_t)(node->kind == AND_NODE ? TRUE_VALUE : FALSE_VALUE));
+                break;
+            }
+            int *exits = malloc(sizeof(int) * node->count);
+            for (int i = 0; i < node->count - 1; i++) {
+                compileNode(compiler, node->children[i], 0);
+                exits[i] = emitJump(compiler, node->kind == AND_NODE ? OP_AND : OP_OR, -1);
+            }
+            compileNode(compiler, node->children[node->count - 1], tail);
+            for (int i = 0; i < node->count - 1; i++) {
+                patchJump(compiler, exits[i]);
+            }
+            free(exits);
+            break;
+        }
+
+        case COND_NODE: {
+            // clauses after an else clause can never run
+            int *exits = malloc(sizeof(int) * (node->count / 2 + 1));
+            int exitCount = 0;
+            int hasElse = 0;
+            for (int i = 0; i < node->count; i += 2) {
+                if (node->children[i] == NULL) {
+                    compileNode(compiler, node->children[i + 1], tail);
+                    hasElse = 1;
+                    break;
+                }
+
+                compileNode(compiler, node->children[i], 0);
+                int toNext = emitJump(compiler, OP_COND_FALSE, -1);
+                if (node->children[i + 1] == NULL) {
+                    // the test is an error, so the clause has no body
+                    emitOp(compiler, OP_IMMEDIATE, 1);
+                    emit(compiler, (intptr_t)VOID_VALUE);
+                } else {
+                    compileNode(compiler, node->children[i + 1], tail);
+                }
+                exits[exitCount++] = emitJump(compiler, OP_JUMP, 0);
+                compiler->depth--;
+                patchJump(compiler, toNext);
+            }
+            if (!hasElse) {
+                emitOp(compiler, OP_IMMEDIATE, 1);
+                emit(compiler, (intptr_t)VOID_VALUE);
+            }
+            for (int i = 0; i < exitCount; i++) {
+                patchJump(compiler, exits[i]);
+            }
+            free(exits);
+            break;
+        }
+
+        case CALL_NODE:
+            for (int i = 0; i < node->count; i++) {
+                compileNode(compiler, node->children[i], 0);
+            }
+            if (node->index != NO_FAST_PATH) {
+                emitOp(compiler, OP_FAST, 0);
+                emit(compiler, node->index);
+            }
+            emitOp(compiler, tail ? OP_TAIL_CALL : OP_CALL, 1 - node->count);
+            emit(compiler, node->count - 1);
+            break;
+
+        case ERROR_NODE:
+            emitOp(compiler, OP_ERROR, 1);
+            emit(compiler, (intptr_t)node);
+            break;
+    }
+}
+
+// An empty sequence is void, like an empty begin.
+static void compileSequence(Compiler *compiler, Node *node, int first, int tail){
+    if (first == node->count) {
+        emitOp(compiler, OP_IMMEDIATE, 1);
+        emit(compiler, (intptr_t)VOID_VALUE);
+        return;
+    }
+    for (int i = first; i < node->count - 1; i++) {
+        compileNode(compiler, node->children[i], 0);
+        emitOp(compiler, OP_POP, -1);
+    }
+    compileNode(compiler, node->children[node->count - 1], tail);
+}
+
+static void emit(Compiler *compiler, intptr_t word){
+    if (compiler->length == compiler->capacity) {
+        compiler->capacity = compiler->capacity == 0 ? 64 : compiler->capacity * 2;
+        compiler->words = realloc(compiler->words, sizeof(intptr_t) * compiler->capacity);
+    }
+    compiler->words[compiler->length++] = word;
+}
+
+static void emitOp(Compiler *compiler, opcode op, int stackEffect){
+    emit(compiler, op);
+    compiler->depth += stackEffect;
+    if (compiler->depth > compiler->maxDepth) {
+        compiler->maxDepth = compiler->depth;
+    }
+}
+
+static int emitJump(Compiler *compiler, opcode op, int stackEffect){
+    int position = compiler->length;
+    emitOp(compiler, op, stackEffect);
+    emit(compiler, 0);
+    return position;
+}
+
+static void patchJump(Compiler *compiler, int position){
+    compiler->words[position + 1] = compiler->length - position;
+}
+
+// Allocation never collects, so the arguments can stay on the stack while
+// the list is built.
+static Value *argumentList(Value **args, int argc){
+    Value *list = makeNull();
+    for (int i = argc - 1; i >= 0; i--) {
+        list = cons(args[i], list);
+    }
+    return list;
+}
+
+static Frame *bindArguments(Value *closure, Value **args, int argc){
+    if (typeOf(closure) != CLOSURE_TYPE) {
+        printf("Evaluation error: undefined procedure\n");
+        texit(0);
+    }
+
+    Node *lambda = closure->closure.code;
+    Frame *callee = tallocStackFrame(lambda->frameSize);
+    callee->parent = closure->closure.frame;
+
+    // a single rest parameter takes all the arguments as a list
+    if (typeOf(lambda->value) == SYMBOL_TYPE) {
+        callee->slots[0] = argumentList(args, argc);
+        return callee;
+    }
+
+    if (lambda->index != argc) {
+        printf("Evaluation error: incurrent number of arguments of procedure\n");
+        texit(0);
+    }
+    memcpy(callee->slots, args, sizeof(Value *) * argc);
+    return callee;
+}
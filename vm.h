@@ -0,0 +1,16 @@
+#include "value.h"
+
+#ifndef _VM
+#define _VM
+
+// Compile an analyzed top-level form to bytecode and run it on the stack
+// machine in the given global frame. Procedures are compiled the first time
+// they are called, and the code is kept in their LAMBDA_NODE. Behaves like
+// running the node with the tree evaluator, error messages included.
+Value *vmExecute(Node *node, Frame *globalFrame);
+
+// Call a closure on argc arguments on the stack machine and return its
+// value. The arguments are copied before anything runs.
+Value *vmApply(Value *closure, int argc, Value **argv);
+
+#endif